@@ -0,0 +1,255 @@
+/*
+ *  Copyright (C) 2013-2018 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QImageReader>
+#include <QPainter>
+#include <QThread>
+#include <exiv2/exiv2.hpp>
+#include "BatchTransform.h"
+#include "MetadataCache.h"
+#include "MetadataWriter.h"
+
+BatchTransform::BatchTransform(const Options &options, int threads, QObject *parent)
+    : QObject(parent), m_options(options), m_threadCount(threads > 0 ? threads : QThread::idealThreadCount())
+{
+    // the XMP toolkit must not initialize lazily from several threads at once
+    Exiv2::XmpParser::initialize();
+}
+
+BatchTransform::~BatchTransform() {
+    cancel();
+    for (QThread *worker : m_workers) {
+        worker->wait();
+        delete worker;
+    }
+}
+
+void BatchTransform::start(const QStringList &imagePaths) {
+    m_mutex.lock();
+    m_jobs = imagePaths;
+    m_total = imagePaths.count();
+    m_done = 0;
+    m_mutex.unlock();
+
+    // the workers write metadata directly, edits still queued for the same files must not race them
+    MetadataWriter::instance()->flush();
+
+    // every worker holds one decoded and one transformed image at most, that's the memory bound
+    const int workers = qMin(m_threadCount, imagePaths.count());
+    for (int i = 0; i < workers; ++i) {
+        QThread *worker = QThread::create([=]() { work(); });
+        worker->start(QThread::LowPriority);
+        m_workers << worker;
+    }
+}
+
+void BatchTransform::cancel() {
+    m_cancel.storeRelaxed(1);
+}
+
+bool BatchTransform::wait(unsigned long msecs) {
+    for (QThread *worker : m_workers) {
+        if (!worker->wait(msecs)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QImage BatchTransform::render(const QImage &source, const QTransform &transform, const QSize &size) {
+    if (!transform.isRotating()) {
+        // copy and scale the area, Qt's downscaling is better than the painter's bilinear filtering
+        const QRect sourceRect = transform.inverted().mapRect(QRectF(QPointF(0, 0), size)).toRect();
+        QImage result = source.copy(sourceRect);
+        if (result.size() != size) {
+            result = result.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+        }
+        if (transform.m11() < 0 || transform.m22() < 0) {
+            result.mirror(transform.m11() < 0, transform.m22() < 0);
+        }
+        return result;
+    }
+
+    QImage target(size, source.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32);
+    target.fill(Qt::black);
+    QPainter painter(&target);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    painter.setTransform(transform);
+    painter.drawImage(0, 0, source);
+    painter.end();
+    return target;
+}
+
+void BatchTransform::work() {
+    forever {
+        m_mutex.lock();
+        if (m_jobs.isEmpty() || m_cancel.loadRelaxed()) {
+            m_mutex.unlock();
+            return;
+        }
+        const QString imagePath = m_jobs.takeFirst();
+        m_mutex.unlock();
+
+        QString error;
+        if (!process(imagePath, &error)) {
+            m_failed.ref();
+            emit failed(imagePath, error);
+        }
+
+        m_mutex.lock();
+        const int done = ++m_done;
+        m_mutex.unlock();
+        emit progress(done, m_total, imagePath);
+    }
+}
+
+bool BatchTransform::process(const QString &imagePath, QString *error) {
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#if EXIV2_TEST_VERSION(0,28,0)
+    Exiv2::Image::UniquePtr metadata;
+    Exiv2::Image::UniquePtr imageOut;
+#else
+    Exiv2::Image::AutoPtr metadata;
+    Exiv2::Image::AutoPtr imageOut;
+#endif
+#pragma clang diagnostic pop
+
+    QString savePath = imagePath;
+    if (!m_options.saveDirectory.isEmpty()) {
+        savePath = QDir(m_options.saveDirectory).filePath(QFileInfo(imagePath).fileName());
+    }
+
+    auto copyOriginal = [&]() {
+        if (savePath == imagePath) {
+            return true;
+        }
+        QFile::remove(savePath);
+        if (!QFile::copy(imagePath, savePath)) {
+            *error = tr("Failed to copy to %1").arg(savePath);
+            return false;
+        }
+        return true;
+    };
+
+    if (m_options.losslessOrientation && m_options.applyOrientation && m_options.keepMetadata &&
+        !m_options.size.isValid() && !m_options.fitSize.isValid() && QImageReader::imageFormat(imagePath) == "jpeg") {
+        Metadata::prefetch(imagePath);
+        const long orientation = Metadata::orientation(Metadata::transformation(imagePath) * m_options.transform);
+        if (orientation) {
+            MetadataWriter::Edit edit;
+            edit.orientation = orientation;
+            if (!copyOriginal() || !MetadataWriter::apply(savePath, edit, error)) {
+                return false;
+            }
+            Metadata::forget(savePath);
+            return true;
+        }
+    }
+
+    const bool changesPixels = !m_options.transform.isIdentity() || m_options.size.isValid() ||
+                               m_options.fitSize.isValid() || m_options.applyOrientation;
+    if (!changesPixels) {
+        // nothing to decode, only the metadata changes
+        if (!copyOriginal()) {
+            return false;
+        }
+        if (!m_options.keepMetadata) try {
+            imageOut = Exiv2::ImageFactory::open(savePath.toStdString());
+            imageOut->clearMetadata();
+            imageOut->writeMetadata();
+        } catch (Exiv2::Error &exiv2Error) {
+            *error = QString::fromUtf8(exiv2Error.what());
+            return false;
+        }
+        Metadata::forget(savePath);
+        return true;
+    }
+
+    if (m_options.keepMetadata) try {
+        metadata = Exiv2::ImageFactory::open(imagePath.toStdString());
+        metadata->readMetadata();
+    } catch (Exiv2::Error &exiv2Error) {
+        qWarning() << "EXIV2:" << exiv2Error.what();
+        metadata.reset();
+    }
+
+    QImageReader reader(imagePath);
+    const QByteArray format = reader.format().toUpper();
+    QImage image;
+    if (!reader.read(&image)) {
+        *error = reader.errorString();
+        return false;
+    }
+    if (m_options.applyOrientation) {
+        Metadata::prefetch(imagePath);
+        image = image.transformed(Metadata::transformation(imagePath), Qt::SmoothTransformation);
+    }
+
+    QTransform transform = m_options.transform;
+    QSize size = m_options.size;
+    if (m_options.referenceSize.isValid() && image.size() != m_options.referenceSize) {
+        const qreal scale = qMin(qreal(image.width()) / m_options.referenceSize.width(),
+                                 qreal(image.height()) / m_options.referenceSize.height());
+        transform = QTransform::fromScale(1.0 / scale, 1.0 / scale) * transform * QTransform::fromScale(scale, scale);
+        size *= scale;
+    }
+    if (!size.isValid()) {
+        const QRectF bounds = transform.mapRect(QRectF(QPointF(0, 0), image.size()));
+        transform *= QTransform::fromTranslate(-bounds.x(), -bounds.y());
+        size = bounds.size().toSize();
+    }
+    if (m_options.fitSize.isValid() && (size.width() > m_options.fitSize.width() ||
+                                        size.height() > m_options.fitSize.height())) {
+        const QSize fitted = size.scaled(m_options.fitSize, Qt::KeepAspectRatio);
+        transform *= QTransform::fromScale(qreal(fitted.width()) / size.width(), qreal(fitted.height()) / size.height());
+        size = fitted;
+    }
+    if (size.isEmpty()) {
+        *error = tr("Nothing left of the image");
+        return false;
+    }
+
+    image = render(image, transform, size);
+    if (!image.save(savePath, format.isEmpty() ? nullptr : format.constData(), m_options.quality)) {
+        *error = tr("Failed to save %1").arg(savePath);
+        return false;
+    }
+    Metadata::forget(savePath);
+
+    if (metadata) try {
+        imageOut = Exiv2::ImageFactory::open(savePath.toStdString());
+        imageOut->setMetadata(*metadata);
+        Exiv2::ExifThumb thumb(imageOut->exifData());
+        thumb.erase();
+        if (m_options.applyOrientation) {
+            // the pixels are upright now
+            Exiv2::ExifData::iterator it = imageOut->exifData().findKey(Exiv2::ExifKey("Exif.Image.Orientation"));
+            if (it != imageOut->exifData().end()) {
+                it->setValue("1");
+            }
+        }
+        imageOut->writeMetadata();
+    } catch (Exiv2::Error &exiv2Error) {
+        qWarning() << "Failed to copy Exif metadata to" << savePath << exiv2Error.what();
+    }
+    return true;
+}
@@ -0,0 +1,85 @@
+/*
+ *  Copyright (C) 2013-2018 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BATCH_TRANSFORM_H
+#define BATCH_TRANSFORM_H
+
+class QThread;
+#include <QAtomicInt>
+#include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QStringList>
+#include <QTransform>
+
+// Decodes, transforms and saves image files on a pool of worker threads, copying their metadata along.
+// Nothing in here touches the GUI, so it serves the viewer as well as the command line.
+class BatchTransform : public QObject {
+Q_OBJECT
+
+public:
+    struct Options {
+        // maps the pixels of an image onto the result
+        QTransform transform;
+        // of the result, the bounds of the transformed image if invalid
+        QSize size;
+        // images of other sizes get the transformation scaled along, it's in pixels of every image if invalid
+        QSize referenceSize;
+        // scale the result down to fit
+        QSize fitSize;
+        bool applyOrientation = false;
+        // JPEG images that only get turned or flipped by transform keep their pixels and get a new Exif orientation
+        bool losslessOrientation = false;
+        bool keepMetadata = true;
+        int quality = -1;
+        // overwrite the originals if empty
+        QString saveDirectory;
+    };
+
+    BatchTransform(const Options &options, int threads = 0, QObject *parent = nullptr);
+    ~BatchTransform();
+    void start(const QStringList &imagePaths);
+    // files that are being processed still get finished
+    void cancel();
+    // true once all workers are done
+    bool wait(unsigned long msecs);
+    int failedCount() const { return m_failed; }
+
+    // source rendered through transform in a single pass
+    static QImage render(const QImage &source, const QTransform &transform, const QSize &size);
+
+signals:
+    void progress(int done, int total, const QString &imagePath);
+    void failed(const QString &imagePath, const QString &error);
+
+private:
+    bool process(const QString &imagePath, QString *error);
+    void work();
+
+    const Options m_options;
+    const int m_threadCount;
+    QMutex m_mutex;
+    QStringList m_jobs;
+    int m_total = 0;
+    int m_done = 0;
+    QAtomicInt m_failed;
+    QAtomicInt m_cancel;
+    QList<QThread*> m_workers;
+};
+
+#endif // BATCH_TRANSFORM_H
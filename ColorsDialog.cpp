@@ -238,7 +238,7 @@ void ColorsDialog::applyColors(int) {
     Settings::greenVal = greenSlider->value();
     Settings::blueVal = blueSlider->value();
 
-    imageViewer->refresh();
+    imageViewer->previewColors();
 }
 
 void ColorsDialog::ok() {
@@ -269,40 +269,40 @@ void ColorsDialog::reset() {
     greenSlider->setValue(0);
     blueSlider->setValue(0);
 
-    imageViewer->refresh();
+    imageViewer->previewColors();
 }
 
 void ColorsDialog::enableColorize(int state) {
     Settings::colorizeEnabled = state;
-    imageViewer->refresh();
+    imageViewer->previewColors();
 }
 
 void ColorsDialog::redNegative(int state) {
     Settings::rNegateEnabled = state;
-    imageViewer->refresh();
+    imageViewer->previewColors();
 }
 
 void ColorsDialog::greenNegative(int state) {
     Settings::gNegateEnabled = state;
-    imageViewer->refresh();
+    imageViewer->previewColors();
 }
 
 void ColorsDialog::blueNegative(int state) {
     Settings::bNegateEnabled = state;
-    imageViewer->refresh();
+    imageViewer->previewColors();
 }
 
 void ColorsDialog::setRedChannel() {
     Settings::hueRedChannel = redCheckBox->isChecked();
-    imageViewer->refresh();
+    imageViewer->previewColors();
 }
 
 void ColorsDialog::setGreenChannel() {
     Settings::hueGreenChannel = greenCheckBox->isChecked();
-    imageViewer->refresh();
+    imageViewer->previewColors();
 }
 
 void ColorsDialog::setBlueChannel() {
     Settings::hueBlueChannel = blueCheckBox->isChecked();
-    imageViewer->refresh();
+    imageViewer->previewColors();
 }
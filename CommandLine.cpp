@@ -0,0 +1,335 @@
+/*
+ *  Copyright (C) 2013-2015 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QTextStream>
+#include <QThread>
+#include <climits>
+#include <functional>
+#include "BatchTransform.h"
+#include "CommandLine.h"
+#include "ThumbnailCache.h"
+
+namespace CommandLine {
+
+static const char *const gs_headlessOptions[] = {
+    "thumbnails", "duplicates", "rotate", "crop", "resize", "strip-metadata"
+};
+
+// Everything is reported on stdout as tab separated lines:
+// progress <done> <total> <path>, error <path> <message> and duplicate <group> <path>
+static QMutex gs_outputMutex;
+
+static void report(const QStringList &fields) {
+    QMutexLocker locker(&gs_outputMutex);
+    static QTextStream out(stdout);
+    out << fields.join('\t') << Qt::endl;
+}
+
+bool isHeadless(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        const QByteArray argument(argv[i]);
+        for (const char *option : gs_headlessOptions) {
+            const QByteArray name = QByteArray("--") + option;
+            if (argument == name || argument.startsWith(name + '=')) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void addOptions(QCommandLineParser &parser) {
+    parser.addOption(QCommandLineOption("thumbnails",
+            QCoreApplication::translate("main", "Store thumbnails for the images, without opening a window.")));
+    parser.addOption(QCommandLineOption("duplicates",
+            QCoreApplication::translate("main", "List the images that look alike, without opening a window.")));
+    parser.addOption(QCommandLineOption("rotate",
+            QCoreApplication::translate("main", "Rotate the images clockwise by <degrees>, without opening a window."),
+            QCoreApplication::translate("main", "degrees")));
+    parser.addOption(QCommandLineOption("crop",
+            QCoreApplication::translate("main", "Crop the images to <x,y,width,height> before rotating them, without opening a window."),
+            QCoreApplication::translate("main", "x,y,width,height")));
+    parser.addOption(QCommandLineOption("resize",
+            QCoreApplication::translate("main", "Scale the images down to fit <width>x<height>, without opening a window."),
+            QCoreApplication::translate("main", "width>x<height")));
+    parser.addOption(QCommandLineOption("strip-metadata",
+            QCoreApplication::translate("main", "Remove all metadata from the images, without opening a window.")));
+    parser.addOption(QCommandLineOption("threads",
+            QCoreApplication::translate("main", "Use <count> threads for batch operations, all cores by default."),
+            QCoreApplication::translate("main", "count")));
+    parser.addOption(QCommandLineOption("io-threads",
+            QCoreApplication::translate("main", "Read at most <count> files at once when storing thumbnails, 2 by default."),
+            QCoreApplication::translate("main", "count")));
+    parser.addOption(QCommandLineOption("low-priority",
+            QCoreApplication::translate("main", "Store thumbnails only when the processor is otherwise idle.")));
+    parser.addOption(QCommandLineOption("lossless",
+            QCoreApplication::translate("main", "Turn and flip JPEG images by changing their Exif orientation instead of saving them anew.")));
+    parser.addOption(QCommandLineOption("quality",
+            QCoreApplication::translate("main", "Save images with <quality> between 0 and 100."),
+            QCoreApplication::translate("main", "quality")));
+}
+
+// the files and the images in the directories below the arguments, like the viewer lists them
+static QStringList imageFiles(const QStringList &arguments) {
+    const QStringList imageTypeGlobs = ThumbnailCache::imageTypeGlobs();
+    QStringList files;
+    for (const QString &argument : arguments) {
+        const QFileInfo info(argument);
+        if (!info.isDir()) {
+            files << info.absoluteFilePath();
+            continue;
+        }
+        QDirIterator it(info.absoluteFilePath(), imageTypeGlobs, QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            files << it.next();
+        }
+    }
+    return files;
+}
+
+// The files that share their name with another one, which would overwrite each other in one output directory
+static QStringList nameCollisions(const QStringList &files) {
+    auto nameOf = [](const QString &file) {
+#if defined(Q_OS_WIN) || defined(Q_OS_DARWIN)
+        return QFileInfo(file).fileName().toCaseFolded();
+#else
+        return QFileInfo(file).fileName();
+#endif
+    };
+    QHash<QString, int> counts;
+    for (const QString &file : files) {
+        ++counts[nameOf(file)];
+    }
+    QStringList collisions;
+    for (const QString &file : files) {
+        if (counts.value(nameOf(file)) > 1) {
+            collisions << file;
+        }
+    }
+    return collisions;
+}
+
+// Runs work for every file on threads workers and reports on the way, returns the number of failures
+static int forEachFile(const QStringList &files, int threads,
+                       const std::function<bool(const QString &, QString *)> &work) {
+    QMutex mutex;
+    int next = 0;
+    int done = 0;
+    int failures = 0;
+    auto worker = [&]() {
+        forever {
+            mutex.lock();
+            if (next == files.count()) {
+                mutex.unlock();
+                return;
+            }
+            const QString file = files.at(next++);
+            mutex.unlock();
+
+            QString error;
+            const bool ok = work(file, &error);
+
+            mutex.lock();
+            ++done;
+            if (!ok) {
+                ++failures;
+            }
+            const int doneNow = done;
+            mutex.unlock();
+            if (!ok) {
+                report({"error", file, error});
+            }
+            report({"progress", QString::number(doneNow), QString::number(files.count()), file});
+        }
+    };
+
+    QList<QThread*> workers;
+    for (int i = 0; i < qMin(threads, files.count()); ++i) {
+        QThread *thread = QThread::create(worker);
+        thread->start();
+        workers << thread;
+    }
+    for (QThread *thread : workers) {
+        thread->wait();
+        delete thread;
+    }
+    return failures;
+}
+
+static int findDuplicates(const QStringList &files, int threads) {
+    QMutex mutex;
+    QHash<QBitArray, QStringList> lookalikes;
+    const int failures = forEachFile(files, threads, [&](const QString &file, QString *error) {
+        bool ok;
+        const QBitArray hash = ThumbnailCache::differenceHash(file, 200, &ok);
+        if (!ok) {
+            *error = QCoreApplication::translate("main", "invalid image");
+            return false;
+        }
+        QMutexLocker locker(&mutex);
+        lookalikes[hash] << file;
+        return true;
+    });
+
+    int group = 0;
+    for (QStringList &paths : lookalikes) {
+        if (paths.count() < 2) {
+            continue;
+        }
+        paths.sort();
+        for (const QString &path : paths) {
+            report({"duplicate", QString::number(group), path});
+        }
+        ++group;
+    }
+    return failures;
+}
+
+int run(const QCommandLineParser &parser, const QString &outputDirectory) {
+    int threads = QThread::idealThreadCount();
+    if (parser.isSet("threads")) {
+        bool ok;
+        threads = parser.value("threads").toInt(&ok);
+        if (!ok || threads < 1) {
+            report({"error", "--threads", QCoreApplication::translate("main", "invalid thread count")});
+            return UsageError;
+        }
+    }
+
+    const QStringList files = imageFiles(parser.positionalArguments());
+    if (files.isEmpty()) {
+        report({"error", QString(), QCoreApplication::translate("main", "no images given")});
+        return UsageError;
+    }
+
+    int failures = 0;
+    if (parser.isSet("thumbnails")) {
+        int readers = 2;
+        if (parser.isSet("io-threads")) {
+            bool ok;
+            readers = parser.value("io-threads").toInt(&ok);
+            if (!ok || readers < 1) {
+                report({"error", "--io-threads", QCoreApplication::translate("main", "invalid thread count")});
+                return UsageError;
+            }
+        }
+        ThumbnailWarmer warmer(threads, readers, parser.isSet("low-priority"));
+        QObject::connect(&warmer, &ThumbnailWarmer::failed, [](const QString &path, const QString &error) {
+            report({"error", path, error});
+        });
+        QObject::connect(&warmer, &ThumbnailWarmer::progress, [](int done, int total, const QString &path) {
+            report({"progress", QString::number(done), QString::number(total), path});
+        });
+        warmer.start(files);
+        warmer.wait(ULONG_MAX);
+        failures += warmer.failedCount();
+    }
+    if (parser.isSet("duplicates")) {
+        failures += findDuplicates(files, threads);
+    }
+
+    const bool transform = parser.isSet("rotate") || parser.isSet("crop") || parser.isSet("resize");
+    if (transform || parser.isSet("strip-metadata")) {
+        BatchTransform::Options options;
+        options.keepMetadata = !parser.isSet("strip-metadata");
+        options.saveDirectory = outputDirectory;
+        options.applyOrientation = transform;
+        options.losslessOrientation = parser.isSet("lossless");
+        if (parser.isSet("quality")) {
+            bool ok;
+            options.quality = parser.value("quality").toInt(&ok);
+            if (!ok || options.quality < 0 || options.quality > 100) {
+                report({"error", "--quality", QCoreApplication::translate("main", "expected a quality between 0 and 100")});
+                return UsageError;
+            }
+        }
+
+        QTransform rotation;
+        if (parser.isSet("rotate")) {
+            bool ok;
+            rotation.rotate(parser.value("rotate").toDouble(&ok));
+            if (!ok) {
+                report({"error", "--rotate", QCoreApplication::translate("main", "invalid angle")});
+                return UsageError;
+            }
+        }
+        if (parser.isSet("crop")) {
+            const QStringList values = parser.value("crop").split(',');
+            QList<int> numbers;
+            for (const QString &value : values) {
+                bool ok;
+                numbers << value.toInt(&ok);
+                if (!ok) {
+                    numbers.clear();
+                    break;
+                }
+            }
+            if (numbers.count() != 4 || numbers.at(2) < 1 || numbers.at(3) < 1) {
+                report({"error", "--crop", QCoreApplication::translate("main", "expected x,y,width,height")});
+                return UsageError;
+            }
+            // crop, then rotate what's left into positive coordinates
+            const QRectF bounds = rotation.mapRect(QRectF(0, 0, numbers.at(2), numbers.at(3)));
+            options.transform = QTransform::fromTranslate(-numbers.at(0), -numbers.at(1)) * rotation *
+                                QTransform::fromTranslate(-bounds.x(), -bounds.y());
+            options.size = bounds.size().toSize();
+        } else {
+            options.transform = rotation;
+        }
+        if (parser.isSet("resize")) {
+            const QStringList values = parser.value("resize").split('x');
+            options.fitSize = values.count() == 2 ? QSize(values.at(0).toInt(), values.at(1).toInt()) : QSize();
+            if (options.fitSize.isEmpty()) {
+                report({"error", "--resize", QCoreApplication::translate("main", "expected <width>x<height>")});
+                return UsageError;
+            }
+        }
+
+        // the output directory is flat, files of the same name from different directories are refused up front
+        QStringList batchFiles = files;
+        if (!outputDirectory.isEmpty()) {
+            const QStringList collisions = nameCollisions(files);
+            for (const QString &file : collisions) {
+                report({"error", file, QCoreApplication::translate("main", "another image of the same name goes to the output directory")});
+                batchFiles.removeOne(file);
+            }
+            failures += collisions.count();
+        }
+
+        BatchTransform batch(options, threads);
+        QObject::connect(&batch, &BatchTransform::progress, [](int done, int total, const QString &imagePath) {
+            report({"progress", QString::number(done), QString::number(total), imagePath});
+        });
+        QObject::connect(&batch, &BatchTransform::failed, [](const QString &imagePath, const QString &error) {
+            report({"error", imagePath, error});
+        });
+        batch.start(batchFiles);
+        batch.wait(ULONG_MAX);
+        failures += batch.failedCount();
+    }
+
+    return failures ? Failure : Success;
+}
+
+} // namespace CommandLine
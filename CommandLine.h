@@ -0,0 +1,40 @@
+/*
+ *  Copyright (C) 2013-2015 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMMAND_LINE_H
+#define COMMAND_LINE_H
+
+class QCommandLineParser;
+#include <QString>
+
+// Batch operations that run without a display, driven by command line options
+namespace CommandLine {
+    enum ExitCode {
+        Success = 0,
+        Failure = 1, // some files could not be processed
+        UsageError = 2
+    };
+
+    // whether the arguments ask for batch work rather than the viewer, before there is an application to parse them
+    bool isHeadless(int argc, char *argv[]);
+    void addOptions(QCommandLineParser &parser);
+    // returns the exit code
+    int run(const QCommandLineParser &parser, const QString &outputDirectory);
+};
+
+#endif // COMMAND_LINE_H
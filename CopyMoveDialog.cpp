@@ -25,6 +25,8 @@
 #include <QPushButton>
 
 #include "CopyMoveDialog.h"
+#include "FileCopier.h"
+#include "MessageBox.h"
 #include "Settings.h"
 #include "ThumbsViewer.h"
 
@@ -92,52 +94,70 @@ CopyMoveDialog::CopyMoveDialog(QWidget *parent) : QDialog(parent) {
 void CopyMoveDialog::execute(ThumbsViewer *thumbView, QString &destDir, bool pasteInCurrDir) {
     show();
 
+    QStringList sourceFiles;
     if (pasteInCurrDir) {
-        for (int tn = 0; tn < Settings::copyCutFileList.size(); ++tn) {
-            QString sourceFile = Settings::copyCutFileList.at(tn);
-            QString destFile = destDir + QDir::separator() + QFileInfo(sourceFile).fileName();
-
-            opLabel->setText((Settings::isCopyOperation ? tr("Copying \"%1\" to \"%2\".") : tr("Moving \"%1\" to \"%2\"."))
-                                     .arg(sourceFile).arg(destFile));
-            QApplication::processEvents();
+        sourceFiles = Settings::copyCutFileList;
+    } else {
+        for (int tn = Settings::copyCutIndexList.size() - 1; tn >= 0; --tn) {
+            sourceFiles.append(thumbView->fullPathOf(Settings::copyCutIndexList.at(tn).row()));
+        }
+    }
 
-            int res = copyOrMoveFile(sourceFile, destFile, Settings::isCopyOperation);
+    QStringList failures;
+    FileCopier copier(!Settings::isCopyOperation);
+    connect(&copier, &FileCopier::progress, this, [=](qint64 bytesDone, qint64 bytesTotal, const QString &destFile) {
+        opLabel->setText((Settings::isCopyOperation ? tr("Copying to \"%1\", %2 of %3.") : tr("Moving to \"%1\", %2 of %3."))
+                                 .arg(destFile).arg(locale().formattedDataSize(bytesDone))
+                                 .arg(locale().formattedDataSize(bytesTotal)));
+    });
+    connect(&copier, &FileCopier::failed, this, [&failures](const QString &sourceFile, const QString &error) {
+        failures << sourceFile + ": " + error;
+    });
+    copier.start(sourceFiles, destDir);
+    while (!copier.wait(30)) {
+        QApplication::processEvents();
+        if (abortOp) {
+            copier.cancel();
+        }
+    }
+    // deliver what the workers reported last
+    QApplication::processEvents();
 
-            if (!res || abortOp) {
-                break;
-            } else {
-                Settings::copyCutFileList[tn] = destFile;
+    const QStringList destFiles = copier.destinations();
+    nFiles = 0;
+    if (pasteInCurrDir) {
+        Settings::copyCutFileList.clear();
+        for (const QString &destFile : destFiles) {
+            if (!destFile.isEmpty()) {
+                Settings::copyCutFileList.append(destFile);
+                ++nFiles;
             }
         }
     } else {
+        // live updates may have changed the rows while the files were copied, they're looked up only now
         QList<int> rowList;
-        for (int tn = Settings::copyCutIndexList.size() - 1; tn >= 0; --tn) {
-            QString sourceFile = thumbView->fullPathOf(Settings::copyCutIndexList.at(tn).row());
-            QString destFile = destDir + QDir::separator() + QFileInfo(sourceFile).fileName();
-
-            opLabel->setText((Settings::isCopyOperation ? tr("Copying \"%1\" to \"%2\".") : tr("Moving \"%1\" to \"%2\"."))
-                                     .arg(sourceFile).arg(destFile));
-            QApplication::processEvents();
-
-            int res = copyOrMoveFile(sourceFile, destFile, Settings::isCopyOperation);
-
-            if (!res || abortOp) {
-                break;
+        for (int tn = 0; tn < destFiles.size(); ++tn) {
+            if (!destFiles.at(tn).isEmpty()) {
+                ++nFiles;
+                const int row = thumbView->rowOf(sourceFiles.at(tn));
+                if (row > -1) {
+                    rowList.append(row);
+                }
             }
-
-            rowList.append(Settings::copyCutIndexList.at(tn).row());
         }
 
+        latestRow = rowList.size() ? *std::min_element(rowList.begin(), rowList.end()) : -1;
         if (!Settings::isCopyOperation) {
-            std::sort(rowList.begin(), rowList.end());
-            for (int t = rowList.size() - 1; t >= 0; --t)
-                thumbView->model()->removeRow(rowList.at(t));
+            thumbView->removeThumbRows(rowList);
         }
-        latestRow = rowList.size() ? rowList.at(0) : -1;
     }
-
-    nFiles = Settings::copyCutIndexList.size();
     close();
+
+    if (!failures.isEmpty() && !abortOp) {
+        MessageBox msgBox(parentWidget());
+        msgBox.critical(tr("Error"), tr("Failed to copy or move %n image(s).", "", failures.count()) + "\n" +
+                                     failures.mid(0, 10).join("\n"));
+    }
 }
 
 void CopyMoveDialog::abort() {
@@ -0,0 +1,174 @@
+/*
+ *  Copyright (C) 2013-2018 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileSystemWatcher>
+#include <QSocketNotifier>
+#include "DirectoryWatcher.h"
+
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// a followed file that didn't change for this long has been written completely
+static const int gs_settleInterval = 2000;
+
+DirectoryWatcher::DirectoryWatcher(QObject *parent) : QObject(parent) {
+#ifdef Q_OS_LINUX
+    m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify >= 0) {
+        m_notifier = new QSocketNotifier(m_inotify, QSocketNotifier::Read, this);
+        connect(m_notifier, &QSocketNotifier::activated, this, &DirectoryWatcher::readEvents);
+        return;
+    }
+    qWarning() << "inotify is not available, falling back to QFileSystemWatcher";
+#endif
+    m_watcher = new QFileSystemWatcher(this);
+    connect(m_watcher, &QFileSystemWatcher::directoryChanged, this, &DirectoryWatcher::directoryChanged);
+    connect(m_watcher, &QFileSystemWatcher::fileChanged, this, [=](const QString &path) {
+        m_writtenFiles.insert(path);
+        emit fileChanged(path);
+    });
+    m_settleTimer.setInterval(gs_settleInterval);
+    connect(&m_settleTimer, &QTimer::timeout, this, &DirectoryWatcher::settleFiles);
+}
+
+DirectoryWatcher::~DirectoryWatcher() {
+#ifdef Q_OS_LINUX
+    if (m_inotify >= 0) {
+        close(m_inotify);
+    }
+#endif
+}
+
+void DirectoryWatcher::addDirectories(const QStringList &paths) {
+#ifdef Q_OS_LINUX
+    if (m_inotify >= 0) {
+        // a file rewritten in place is closed after writing, that's when its thumbnail can be redone
+        const uint32_t mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |
+                              IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+        for (const QString &path : paths) {
+            const int watch = inotify_add_watch(m_inotify, QFile::encodeName(path).constData(), mask);
+            if (watch >= 0) {
+                m_directories.insert(watch, QDir::cleanPath(path));
+            }
+        }
+        return;
+    }
+#endif
+    m_watcher->addPaths(paths);
+}
+
+void DirectoryWatcher::clear() {
+#ifdef Q_OS_LINUX
+    if (m_inotify >= 0) {
+        for (QHash<int, QString>::const_iterator it = m_directories.cbegin(); it != m_directories.cend(); ++it) {
+            inotify_rm_watch(m_inotify, it.key());
+        }
+        m_directories.clear();
+        return;
+    }
+#endif
+    const QStringList watchedPaths = m_watcher->directories() + m_watcher->files();
+    if (!watchedPaths.isEmpty()) {
+        m_watcher->removePaths(watchedPaths);
+    }
+    m_settlingFiles.clear();
+    m_writtenFiles.clear();
+    m_settleTimer.stop();
+}
+
+void DirectoryWatcher::followFile(const QString &path) {
+    if (!m_watcher) {
+        return; // inotify reports when the file is closed after writing
+    }
+    if (m_watcher->addPath(path)) {
+        m_settlingFiles.insert(path);
+        if (!m_settleTimer.isActive()) {
+            m_settleTimer.start();
+        }
+    }
+}
+
+// stop following files once they are written, a busy tether directory would run out of watches otherwise
+void DirectoryWatcher::settleFiles() {
+    QStringList settled;
+    for (const QString &path : std::as_const(m_settlingFiles)) {
+        if (!m_writtenFiles.contains(path)) {
+            settled.append(path);
+        }
+    }
+    for (const QString &path : std::as_const(settled)) {
+        m_settlingFiles.remove(path);
+    }
+    if (!settled.isEmpty()) {
+        m_watcher->removePaths(settled);
+    }
+    m_writtenFiles.clear();
+    if (m_settlingFiles.isEmpty()) {
+        m_settleTimer.stop();
+    }
+}
+
+void DirectoryWatcher::readEvents() {
+#ifdef Q_OS_LINUX
+    alignas(struct inotify_event) char buffer[16 * 1024];
+    forever {
+        const ssize_t length = read(m_inotify, buffer, sizeof(buffer));
+        if (length <= 0) {
+            return;
+        }
+        for (const char *event = buffer; event < buffer + length; ) {
+            const struct inotify_event *e = reinterpret_cast<const struct inotify_event *>(event);
+            event += sizeof(struct inotify_event) + e->len;
+
+            if (e->mask & IN_Q_OVERFLOW) {
+                // events were lost, only a listing tells what happened
+                for (const QString &directory : std::as_const(m_directories)) {
+                    emit directoryChanged(directory);
+                }
+                continue;
+            }
+            const QString directory = m_directories.value(e->wd);
+            if (directory.isEmpty()) {
+                continue;
+            }
+            if (e->mask & IN_IGNORED) {
+                m_directories.remove(e->wd);
+                continue;
+            }
+            if (e->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                emit directoryChanged(directory);
+                continue;
+            }
+            if (!e->len) {
+                continue;
+            }
+            const QString path = QDir(directory).filePath(QFile::decodeName(e->name));
+            if (!(e->mask & IN_ISDIR)) {
+                emit fileChanged(path);
+            } else if (e->mask & (IN_CREATE | IN_MOVED_TO)) {
+                emit directoryAdded(path);
+            }
+        }
+    }
+#endif
+}
@@ -0,0 +1,68 @@
+/*
+ *  Copyright (C) 2013-2018 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DIRECTORY_WATCHER_H
+#define DIRECTORY_WATCHER_H
+
+class QFileSystemWatcher;
+class QSocketNotifier;
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+
+// Reports changes to the files of a set of directories.
+// On Linux one inotify watch per directory tells which file changed, also when a file is rewritten in place.
+// Elsewhere QFileSystemWatcher only tells that a directory changed, and new files are followed on their own
+// until they have been written completely.
+class DirectoryWatcher : public QObject {
+Q_OBJECT
+
+public:
+    DirectoryWatcher(QObject *parent = nullptr);
+    ~DirectoryWatcher();
+    // running out of watches only costs live updates, so there's no result
+    void addDirectories(const QStringList &paths);
+    void clear();
+    // a new file that may still be written to
+    void followFile(const QString &path);
+
+signals:
+    // path was created, written, removed or renamed
+    void fileChanged(const QString &path);
+    // something changed that only listing the directory tells
+    void directoryChanged(const QString &path);
+    // a subdirectory was created or moved into a watched directory, it isn't watched itself yet
+    void directoryAdded(const QString &path);
+
+private:
+    void readEvents();
+    void settleFiles();
+
+    QFileSystemWatcher *m_watcher = nullptr;
+    int m_inotify = -1;
+    QSocketNotifier *m_notifier = nullptr;
+    QHash<int, QString> m_directories;
+    // followed files and those that changed since they were last looked at
+    QSet<QString> m_settlingFiles;
+    QSet<QString> m_writtenFiles;
+    QTimer m_settleTimer;
+};
+
+#endif // DIRECTORY_WATCHER_H
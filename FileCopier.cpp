@@ -0,0 +1,338 @@
+/*
+ *  Copyright (C) 2013-2018 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSet>
+#include <QStorageInfo>
+#include <QThread>
+#include "FileCopier.h"
+#include "MetadataCache.h"
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+// parallel streams per source device, more only make a disk seek between them
+static const int gs_streamsPerDevice = 2;
+// between progress reports and checks for cancellation
+static const qint64 gs_chunkSize = 8 * 1024 * 1024;
+
+// name_copy_N.suffix for the first N that's not taken
+static QString uniqueName(const QString &fileName, const QSet<QString> &taken) {
+    int extSep = fileName.lastIndexOf(".");
+    QString nameOnly = fileName.left(extSep);
+    QString extOnly = fileName.right(fileName.size() - extSep - 1);
+    QString newFile;
+
+    int idx = 1;
+    do {
+        newFile = QString(nameOnly + "_copy_%1." + extOnly).arg(idx);
+        ++idx;
+    } while (idx && taken.contains(newFile));
+
+    return newFile;
+}
+
+FileCopier::FileCopier(bool move, QObject *parent) : QObject(parent), m_move(move) {
+}
+
+FileCopier::~FileCopier() {
+    cancel();
+    for (QThread *worker : m_workers) {
+        worker->wait();
+        delete worker;
+    }
+}
+
+void FileCopier::start(const QStringList &sources, const QString &destinationDirectory) {
+    // one listing of the destination serves all conflicts, instead of probing it per candidate name
+    const QDir destination(destinationDirectory);
+    const QStringList existing = destination.entryList(QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot);
+    QSet<QString> taken(existing.begin(), existing.end());
+    QHash<QString, QString> devices;
+
+    m_mutex.lock();
+    for (const QString &source : sources) {
+        const QFileInfo info(source);
+        QString name = info.fileName();
+        if (taken.contains(name)) {
+            name = uniqueName(name, taken);
+        }
+        taken.insert(name);
+
+        Job job;
+        job.source = source;
+        job.destination = destination.filePath(name);
+        const QString sidecar = Metadata::sidecarPath(source);
+        const QFileInfo sidecarInfo(sidecar);
+        if (sidecarInfo.exists()) {
+            // named after the image the way it was, which may have been renamed to be unique
+            job.sidecar = sidecar;
+            job.sidecarDestination = sidecar == source + QLatin1String(".xmp") ? job.destination + QLatin1String(".xmp")
+                                   : destination.filePath(QFileInfo(name).completeBaseName() + QLatin1String(".xmp"));
+            m_bytesTotal += sidecarInfo.size();
+        }
+        QHash<QString, QString>::iterator device = devices.find(info.path());
+        if (device == devices.end()) {
+            device = devices.insert(info.path(), QString::fromLocal8Bit(QStorageInfo(info.path()).device()));
+        }
+        job.device = *device;
+        m_queue << m_jobs.count();
+        m_jobs << job;
+        m_bytesTotal += info.size();
+    }
+    m_mutex.unlock();
+
+    const int workers = qMin(qMax(gs_streamsPerDevice, QThread::idealThreadCount() / 2), int(sources.count()));
+    for (int i = 0; i < workers; ++i) {
+        QThread *worker = QThread::create([=]() { work(); });
+        worker->start();
+        m_workers << worker;
+    }
+}
+
+void FileCopier::cancel() {
+    QMutexLocker locker(&m_mutex);
+    m_cancel.storeRelaxed(1);
+    m_streamFreed.wakeAll();
+}
+
+bool FileCopier::wait(unsigned long msecs) {
+    for (QThread *worker : m_workers) {
+        if (!worker->wait(msecs)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QStringList FileCopier::destinations() const {
+    QMutexLocker locker(&m_mutex);
+    QStringList destinations;
+    for (const Job &job : m_jobs) {
+        destinations << (job.done ? job.destination : QString());
+    }
+    return destinations;
+}
+
+void FileCopier::addProgress(qint64 bytes, const QString &path) {
+    m_mutex.lock();
+    m_bytesDone += bytes;
+    const qint64 done = m_bytesDone;
+    m_mutex.unlock();
+    emit progress(done, m_bytesTotal, path);
+}
+
+void FileCopier::work() {
+    QMutexLocker locker(&m_mutex);
+    forever {
+        if (m_queue.isEmpty() || m_cancel.loadRelaxed()) {
+            return;
+        }
+        // the first job on a device that has a stream to spare
+        int queued = -1;
+        for (int i = 0; i < m_queue.count(); ++i) {
+            if (m_streams.value(m_jobs.at(m_queue.at(i)).device) < gs_streamsPerDevice) {
+                queued = i;
+                break;
+            }
+        }
+        if (queued < 0) {
+            m_streamFreed.wait(&m_mutex);
+            continue;
+        }
+
+        const int index = m_queue.takeAt(queued);
+        const Job job = m_jobs.at(index);
+        ++m_streams[job.device];
+        locker.unlock();
+
+        QString error;
+        const bool ok = process(job.source, job.destination, &error);
+        QString sidecarError;
+        const bool sidecarOk = !ok || job.sidecar.isEmpty() ||
+                               process(job.sidecar, job.sidecarDestination, &sidecarError);
+
+        locker.relock();
+        --m_streams[job.device];
+        m_jobs[index].done = ok;
+        m_streamFreed.wakeAll();
+        locker.unlock();
+
+        if (!ok) {
+            m_failed.ref();
+            emit failed(job.source, error);
+        }
+        if (!sidecarOk) {
+            m_failed.ref();
+            emit failed(job.sidecar, sidecarError);
+        }
+        locker.relock();
+    }
+}
+
+bool FileCopier::process(const QString &source, const QString &destination, QString *error) {
+    if (m_move) {
+        // only a move to another filesystem gets copied, any other failure to rename would be one to remove as well
+#ifdef Q_OS_LINUX
+        // unlike QDir::rename this tells why it failed
+        if (renameat2(AT_FDCWD, QFile::encodeName(source).constData(),
+                      AT_FDCWD, QFile::encodeName(destination).constData(), RENAME_NOREPLACE) == 0) {
+            addProgress(QFileInfo(destination).size(), destination);
+            return true;
+        }
+        if (errno == EINVAL || errno == ENOSYS) {
+            // the filesystem can't rename without replacing, Qt has its own ways around that
+            if (QDir().rename(source, destination)) {
+                addProgress(QFileInfo(destination).size(), destination);
+                return true;
+            }
+            *error = tr("Failed to move to %1").arg(destination);
+            return false;
+        }
+        if (errno != EXDEV) {
+            *error = QString::fromLocal8Bit(strerror(errno));
+            return false;
+        }
+#else
+        // unlike QFile::rename this never falls back to copying on its own
+        if (QDir().rename(source, destination)) {
+            addProgress(QFileInfo(destination).size(), destination);
+            return true;
+        }
+        if (QStorageInfo(source).rootPath() == QStorageInfo(QFileInfo(destination).path()).rootPath()) {
+            *error = tr("Failed to move to %1").arg(destination);
+            return false;
+        }
+#endif
+        if (!copy(source, destination, error)) {
+            return false;
+        }
+        if (!QFile::remove(source)) {
+            *error = tr("Copied, but failed to remove the original");
+            return false;
+        }
+        return true;
+    }
+    return copy(source, destination, error);
+}
+
+bool FileCopier::copy(const QString &source, const QString &destination, QString *error) {
+    QFile in(source);
+    if (!in.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        *error = in.errorString();
+        return false;
+    }
+    // never clobber something that appeared since the destination was listed
+    QFile out(destination);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::NewOnly | QIODevice::Unbuffered)) {
+        *error = out.errorString();
+        return false;
+    }
+
+    bool ok = copyData(in, out, error);
+    if (ok) {
+        out.setPermissions(in.permissions());
+    }
+    out.close();
+    if (ok && out.error() != QFileDevice::NoError) {
+        *error = out.errorString();
+        ok = false;
+    }
+    if (!ok) {
+        out.remove();
+    }
+    return ok;
+}
+
+bool FileCopier::copyData(QFile &in, QFile &out, QString *error) {
+    const QString &path = out.fileName();
+    const qint64 size = in.size();
+
+#ifdef Q_OS_LINUX
+#ifdef FICLONE
+    // copy on write filesystems share the extents, nothing gets copied at all
+    if (ioctl(out.handle(), FICLONE, in.handle()) == 0) {
+        addProgress(size, path);
+        return true;
+    }
+#endif
+    // in the kernel, without a round trip through user space, or on the server for network filesystems
+    qint64 copied = 0;
+    while (copied < size) {
+        if (m_cancel.loadRelaxed()) {
+            *error = tr("Cancelled");
+            return false;
+        }
+        const ssize_t count = copy_file_range(in.handle(), nullptr, out.handle(), nullptr,
+                                              size_t(qMin(size - copied, gs_chunkSize)), 0);
+        if (count < 0 && copied == 0 &&
+            (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+            break; // not supported between these two, read and write instead
+        }
+        if (count < 0) {
+            *error = QString::fromLocal8Bit(strerror(errno));
+            return false;
+        }
+        if (count == 0) {
+            return true; // the source shrank
+        }
+        copied += count;
+        addProgress(count, path);
+    }
+    if (copied) {
+        return true;
+    }
+#endif
+
+    QByteArray buffer(4 * 1024 * 1024, Qt::Uninitialized);
+    qint64 sinceReport = 0;
+    forever {
+        if (m_cancel.loadRelaxed()) {
+            *error = tr("Cancelled");
+            return false;
+        }
+        const qint64 count = in.read(buffer.data(), buffer.size());
+        if (count < 0) {
+            *error = in.errorString();
+            return false;
+        }
+        if (count == 0) {
+            break;
+        }
+        if (out.write(buffer.constData(), count) != count) {
+            *error = out.errorString();
+            return false;
+        }
+        sinceReport += count;
+        if (sinceReport >= gs_chunkSize) {
+            addProgress(sinceReport, path);
+            sinceReport = 0;
+        }
+    }
+    addProgress(sinceReport, path);
+    return true;
+}
@@ -0,0 +1,84 @@
+/*
+ *  Copyright (C) 2013-2018 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILE_COPIER_H
+#define FILE_COPIER_H
+
+class QFile;
+class QThread;
+#include <QAtomicInt>
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QStringList>
+#include <QWaitCondition>
+
+// Copies or moves files into a directory on worker threads, along with their XMP sidecars.
+// Copies share extents or stay in the kernel where the filesystems allow it,
+// and each source device only gets a few streams at once so disks don't thrash.
+class FileCopier : public QObject {
+Q_OBJECT
+
+public:
+    FileCopier(bool move, QObject *parent = nullptr);
+    ~FileCopier();
+    // names that are taken in destinationDirectory get a _copy_N suffix
+    void start(const QStringList &sources, const QString &destinationDirectory);
+    // files that are being copied are removed again
+    void cancel();
+    // true once all workers are done
+    bool wait(unsigned long msecs);
+    // where each source went, empty for those that failed or were cancelled
+    QStringList destinations() const;
+    int failedCount() const { return m_failed.loadRelaxed(); }
+
+signals:
+    void progress(qint64 bytesDone, qint64 bytesTotal, const QString &path);
+    void failed(const QString &path, const QString &error);
+
+private:
+    struct Job {
+        QString source;
+        QString destination;
+        // the XMP sidecar, which goes along with the image
+        QString sidecar;
+        QString sidecarDestination;
+        QString device;
+        bool done = false;
+    };
+
+    bool process(const QString &source, const QString &destination, QString *error);
+    bool copy(const QString &source, const QString &destination, QString *error);
+    bool copyData(QFile &in, QFile &out, QString *error);
+    void addProgress(qint64 bytes, const QString &path);
+    void work();
+
+    const bool m_move;
+    QList<Job> m_jobs;
+    mutable QMutex m_mutex;
+    QWaitCondition m_streamFreed;
+    QList<int> m_queue;
+    QHash<QString, int> m_streams;
+    qint64 m_bytesTotal = 0;
+    qint64 m_bytesDone = 0;
+    QAtomicInt m_failed;
+    QAtomicInt m_cancel;
+    QList<QThread*> m_workers;
+};
+
+#endif // FILE_COPIER_H
@@ -0,0 +1,159 @@
+/*
+ *  Copyright (C) 2013-2018 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QStorageInfo>
+#include <QThread>
+#include "FileDeleter.h"
+#include "MetadataCache.h"
+
+FileDeleter::FileDeleter(bool trash, QObject *parent) : QObject(parent), m_trash(trash) {
+}
+
+FileDeleter::~FileDeleter() {
+    cancel();
+    for (QThread *worker : m_workers) {
+        worker->wait();
+        delete worker;
+    }
+}
+
+void FileDeleter::start(const QStringList &files) {
+    m_files.clear();
+    m_locationOf.clear();
+    for (const QString &file : files) {
+        m_files << QFileInfo(file).absoluteFilePath();
+    }
+    m_deleted.fill(false, m_files.count());
+
+    if (m_trash) {
+        // selections mostly come from a handful of directories on one or two devices
+        QHash<QString, int> directoryLocations;
+        QHash<QString, int> deviceLocations;
+        for (const QString &file : std::as_const(m_files)) {
+            const QString directory = QFileInfo(file).path();
+            QHash<QString, int>::const_iterator known = directoryLocations.constFind(directory);
+            if (known == directoryLocations.constEnd()) {
+                const QString root = QStorageInfo(directory).rootPath();
+                QHash<QString, int>::const_iterator device = deviceLocations.constFind(root);
+                if (device == deviceLocations.constEnd()) {
+                    Trash::Location location;
+                    QString error;
+                    Trash::locate(file, location, error);
+                    device = deviceLocations.insert(root, m_locations.count());
+                    m_locations << location;
+                    m_locateErrors << error;
+                }
+                known = directoryLocations.insert(directory, *device);
+            }
+            m_locationOf << *known;
+        }
+    }
+
+    int workers = qMin(QThread::idealThreadCount(), int(m_files.count()));
+#ifdef Q_OS_WIN
+    // the shell's file operations aren't meant to run from several threads without COM set up for each
+    if (m_trash) {
+        workers = qMin(1, workers);
+    }
+#endif
+    for (int i = 0; i < workers; ++i) {
+        QThread *worker = QThread::create([=]() { work(); });
+        worker->start();
+        m_workers << worker;
+    }
+}
+
+void FileDeleter::cancel() {
+    m_cancel.storeRelaxed(1);
+}
+
+bool FileDeleter::wait(unsigned long msecs) {
+    for (QThread *worker : m_workers) {
+        if (!worker->wait(msecs)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QStringList FileDeleter::deletedFiles() const {
+    QMutexLocker locker(&m_mutex);
+    QStringList deletedFiles;
+    for (int i = 0; i < m_files.count(); ++i) {
+        if (m_deleted.at(i)) {
+            deletedFiles << m_files.at(i);
+        }
+    }
+    return deletedFiles;
+}
+
+// Trashes or deletes path, which is on the device of m_files[index]
+bool FileDeleter::remove(const QString &path, int index, QString *error) {
+    if (!m_trash) {
+        QFile fileToRemove(path);
+        if (!fileToRemove.remove()) {
+            *error = fileToRemove.errorString();
+            return false;
+        }
+        return true;
+    }
+    const int location = m_locationOf.at(index);
+    if (!m_locateErrors.at(location).isEmpty()) {
+        *error = m_locateErrors.at(location);
+        return false;
+    }
+    return Trash::moveToTrash(path, m_locations.at(location), *error) == Trash::Success;
+}
+
+void FileDeleter::work() {
+    forever {
+        if (m_cancel.loadRelaxed()) {
+            return;
+        }
+        const int index = m_next.fetchAndAddRelaxed(1);
+        if (index >= m_files.count()) {
+            return;
+        }
+        const QString &file = m_files.at(index);
+
+        QString error;
+        const bool ok = remove(file, index, &error);
+        // the XMP sidecar goes wherever the image went
+        const QString sidecar = ok ? Metadata::sidecarPath(file) : QString();
+        QString sidecarError;
+        const bool sidecarOk = !ok || !QFileInfo::exists(sidecar) || remove(sidecar, index, &sidecarError);
+
+        m_mutex.lock();
+        m_deleted[index] = ok;
+        const int done = ++m_done;
+        m_mutex.unlock();
+
+        if (!ok) {
+            m_failed.ref();
+            emit failed(file, error);
+        }
+        if (!sidecarOk) {
+            m_failed.ref();
+            emit failed(sidecar, sidecarError);
+        }
+        emit progress(done, m_files.count(), file);
+    }
+}
@@ -0,0 +1,70 @@
+/*
+ *  Copyright (C) 2013-2018 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILE_DELETER_H
+#define FILE_DELETER_H
+
+class QThread;
+#include <QAtomicInt>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QStringList>
+#include "Trashcan.h"
+
+// Moves files to the trash or deletes them on worker threads, along with their XMP sidecars.
+// The trash of each device is looked up and set up once, not for every file.
+class FileDeleter : public QObject {
+Q_OBJECT
+
+public:
+    FileDeleter(bool trash, QObject *parent = nullptr);
+    ~FileDeleter();
+    void start(const QStringList &files);
+    // files that are already gone stay gone
+    void cancel();
+    // true once all workers are done
+    bool wait(unsigned long msecs);
+    // the files that were trashed or deleted
+    QStringList deletedFiles() const;
+    int failedCount() const { return m_failed.loadRelaxed(); }
+
+signals:
+    void progress(int done, int total, const QString &path);
+    void failed(const QString &path, const QString &error);
+
+private:
+    bool remove(const QString &path, int index, QString *error);
+    void work();
+
+    const bool m_trash;
+    QStringList m_files;
+    // into m_locations, or m_locateErrors when the device has no usable trash
+    QList<int> m_locationOf;
+    QList<Trash::Location> m_locations;
+    QStringList m_locateErrors;
+    mutable QMutex m_mutex;
+    QList<bool> m_deleted;
+    int m_done = 0;
+    QAtomicInt m_next;
+    QAtomicInt m_failed;
+    QAtomicInt m_cancel;
+    QList<QThread*> m_workers;
+};
+
+#endif // FILE_DELETER_H
@@ -16,17 +16,47 @@
  *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <QDirIterator>
+#include <QThread>
 #include "FileSystemModel.h"
 #include "IconProvider.h"
 
+// Looking into directories can take ages on network shares or slow media, so the
+// tree never does that itself. Unknown directories get an expander until a
+// prober thread had a look, the answer is then cached against the directory mtime.
+static const int gs_proberCount = 2;
+
 FileSystemModel::FileSystemModel(QObject *parent) : QFileSystemModel(parent)
 {
     m_iconProvider = new IconProvider;
     setIconProvider(m_iconProvider);
+
+    // the view caches the expanders in its layout, so collect answers and relayout once
+    m_probedTimer.setInterval(100);
+    m_probedTimer.setSingleShot(true);
+    connect(&m_probedTimer, &QTimer::timeout, this, [=]() {
+        emit layoutAboutToBeChanged();
+        emit layoutChanged();
+    });
+
+    for (int i = 0; i < gs_proberCount; ++i) {
+        QThread *prober = QThread::create([=]() { probe(); });
+        prober->start(QThread::LowPriority);
+        m_probers.append(prober);
+    }
 }
 
 FileSystemModel::~FileSystemModel()
 {
+    m_mutex.lock();
+    m_quit = true;
+    m_queue.clear();
+    m_wake.wakeAll();
+    m_mutex.unlock();
+    for (QThread *prober : m_probers) {
+        prober->wait();
+        delete prober;
+    }
     delete m_iconProvider;
 }
 
@@ -43,5 +73,63 @@ bool FileSystemModel::hasChildren(const QModelIndex &parent) const {
         return false;
     }
 
-    return QDirIterator(filePath(parent), filter() | QDir::NoDotAndDotDot, QDirIterator::NoIteratorFlags).hasNext();
+    // already populated, no need to ask
+    if (QFileSystemModel::rowCount(parent) > 0) {
+        return true;
+    }
+
+    // the model has the file info already, this doesn't touch the disk
+    const QString path = filePath(parent);
+    const QDateTime modified = lastModified(parent);
+    QHash<QString, ChildProbe>::const_iterator it = m_probes.constFind(path);
+    if (it != m_probes.constEnd() && it->lastModified == modified) {
+        return it->hasChildren;
+    }
+
+    m_mutex.lock();
+    m_probeFilters = filter() | QDir::NoDotAndDotDot;
+    if (!m_queued.contains(path)) {
+        m_queued.insert(path);
+        m_queue.append(path);
+        m_wake.wakeOne();
+    }
+    m_mutex.unlock();
+
+    // until we know better
+    return it == m_probes.constEnd() ? true : it->hasChildren;
+}
+
+void FileSystemModel::probe() {
+    forever {
+        m_mutex.lock();
+        while (m_queue.isEmpty() && !m_quit) {
+            m_wake.wait(&m_mutex);
+        }
+        if (m_quit) {
+            m_mutex.unlock();
+            return;
+        }
+        // the last requests are the ones currently on screen
+        const QString path = m_queue.takeLast();
+        const QDir::Filters filters = m_probeFilters;
+        m_mutex.unlock();
+
+        const bool hasChildren = QDirIterator(path, filters, QDirIterator::NoIteratorFlags).hasNext();
+        QMetaObject::invokeMethod(this, [=]() { probed(path, hasChildren); }, Qt::QueuedConnection);
+    }
+}
+
+void FileSystemModel::probed(const QString &path, bool hasChildren) {
+    m_mutex.lock();
+    m_queued.remove(path);
+    m_mutex.unlock();
+
+    const QModelIndex idx = index(path);
+    ChildProbe &entry = m_probes[path];
+    const bool changed = entry.lastModified.isNull() ? !hasChildren : entry.hasChildren != hasChildren;
+    entry.lastModified = idx.isValid() ? lastModified(idx) : QDateTime();
+    entry.hasChildren = hasChildren;
+    if (changed && !m_probedTimer.isActive()) {
+        m_probedTimer.start();
+    }
 }
@@ -20,7 +20,14 @@
 #define FILE_SYSTEM_MODEL_H
 
 class IconProvider;
+class QThread;
+#include <QDateTime>
 #include <QFileSystemModel>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QTimer>
+#include <QWaitCondition>
 
 class FileSystemModel : public QFileSystemModel {
 
@@ -29,11 +36,31 @@ Q_OBJECT
 public:
     FileSystemModel(QObject *parent = nullptr);
     ~FileSystemModel();
-    bool hasChildren(const QModelIndex &parent) const;
+    bool hasChildren(const QModelIndex &parent) const override;
 
 private:
+    struct ChildProbe {
+        QDateTime lastModified;
+        bool hasChildren;
+    };
+
+    void probe();
+    void probed(const QString &path, bool hasChildren);
+
     IconProvider *m_iconProvider;
+
+    // answers are only valid as long as the directory mtime doesn't change
+    mutable QHash<QString, ChildProbe> m_probes;
+    QTimer m_probedTimer;
+
+    // shared with the prober threads
+    mutable QMutex m_mutex;
+    mutable QWaitCondition m_wake;
+    mutable QStringList m_queue;
+    mutable QSet<QString> m_queued;
+    mutable QDir::Filters m_probeFilters;
+    bool m_quit = false;
+    QList<QThread*> m_probers;
 };
 
 #endif // FILE_SYSTEM_MODEL_H
-
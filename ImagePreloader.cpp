@@ -0,0 +1,229 @@
+/*
+ *  Copyright (C) 2013-2018 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QFileInfo>
+#include <QImageReader>
+#include <QThread>
+#include "ImagePreloader.h"
+#include "MetadataCache.h"
+#include "Settings.h"
+
+static const int gs_decoderCount = 2;
+// a handful of decoded 50MP images each, no more
+static const qint64 gs_memoryBudget = qint64(768) << 20;
+static const qint64 gs_recentBudget = qint64(768) << 20;
+// ImageViewer::reload() scales those down and warns, leave them to it
+static const qint64 gs_maxPixels = 8192 * 8192;
+
+ImagePreloader::ImagePreloader() {
+    for (int i = 0; i < gs_decoderCount; ++i) {
+        QThread *decoder = QThread::create([=]() { decode(); });
+        decoder->start(QThread::LowPriority);
+        m_decoders.append(decoder);
+    }
+}
+
+ImagePreloader::~ImagePreloader() {
+    m_mutex.lock();
+    m_quit = true;
+    m_jobs.clear();
+    m_wake.wakeAll();
+    m_mutex.unlock();
+    for (QThread *decoder : m_decoders) {
+        decoder->wait();
+        delete decoder;
+    }
+}
+
+void ImagePreloader::setQueue(const QStringList &imagePaths) {
+    QMutexLocker locker(&m_mutex);
+    m_wanted = imagePaths;
+    m_exifRotation = Settings::exifRotationEnabled;
+
+    QHash<QString, Decoded>::iterator it = m_decoded.begin();
+    while (it != m_decoded.end()) {
+        if (m_wanted.contains(it.key())) {
+            ++it;
+        } else {
+            m_decodedBytes -= it->image.sizeInBytes();
+            it = m_decoded.erase(it);
+        }
+    }
+
+    // running decodes of paths that aren't wanted anymore get discarded when they're done
+    m_jobs.clear();
+    for (const QString &imagePath : m_wanted) {
+        if (!m_decoded.contains(imagePath) && !m_running.contains(imagePath) && !m_recent.contains(imagePath)) {
+            m_jobs.append(imagePath);
+        }
+    }
+    if (!m_jobs.isEmpty()) {
+        m_wake.wakeAll();
+    }
+}
+
+QImage ImagePreloader::take(const QString &imagePath) {
+    QMutexLocker locker(&m_mutex);
+    QHash<QString, Decoded>::iterator it = m_decoded.find(imagePath);
+    if (it != m_decoded.end()) {
+        if (it->lastModified == QFileInfo(imagePath).lastModified()) {
+            return it->image;
+        }
+        // changed on disk
+        m_decodedBytes -= it->image.sizeInBytes();
+        m_decoded.erase(it);
+        return QImage();
+    }
+
+    QHash<QString, Recent>::const_iterator recent = m_recent.constFind(imagePath);
+    if (recent == m_recent.constEnd()) {
+        return QImage();
+    }
+    if (recent->lastModified != QFileInfo(imagePath).lastModified()) {
+        forgetRecent(imagePath);
+        return QImage();
+    }
+    m_recentOrder.removeOne(imagePath);
+    m_recentOrder.append(imagePath);
+    return recent->original;
+}
+
+QImage ImagePreloader::takeDerived(const QString &imagePath, const QByteArray &derivation) {
+    QMutexLocker locker(&m_mutex);
+    QHash<QString, Recent>::const_iterator recent = m_recent.constFind(imagePath);
+    if (recent == m_recent.constEnd() || recent->derivation != derivation ||
+        recent->lastModified != QFileInfo(imagePath).lastModified()) {
+        return QImage();
+    }
+    return recent->derived;
+}
+
+static inline qint64 derivedBytes(const QImage &original, const QImage &derived) {
+    // unless colors or mirroring were applied the viewer image shares the original's data
+    return derived.cacheKey() == original.cacheKey() ? 0 : derived.sizeInBytes();
+}
+
+void ImagePreloader::keep(const QString &imagePath, const QDateTime &lastModified,
+                          const QImage &original, const QImage &derived, const QByteArray &derivation) {
+    QMutexLocker locker(&m_mutex);
+    forgetRecent(imagePath);
+    if (original.isNull() || original.sizeInBytes() > gs_recentBudget) {
+        return;
+    }
+
+    Recent recent;
+    recent.original = original;
+    recent.derived = derived;
+    recent.derivation = derivation;
+    recent.lastModified = lastModified;
+    m_recent.insert(imagePath, recent);
+    m_recentOrder.append(imagePath);
+    m_recentOriginalBytes += original.sizeInBytes();
+    m_recentDerivedBytes += derivedBytes(original, derived);
+    evictRecent();
+}
+
+void ImagePreloader::forgetRecent(const QString &imagePath) {
+    QHash<QString, Recent>::iterator it = m_recent.find(imagePath);
+    if (it == m_recent.end()) {
+        return;
+    }
+    m_recentOriginalBytes -= it->original.sizeInBytes();
+    m_recentDerivedBytes -= derivedBytes(it->original, it->derived);
+    m_recent.erase(it);
+    m_recentOrder.removeOne(imagePath);
+}
+
+void ImagePreloader::evictRecent() {
+    // derived images are cheaper to recreate than decoding the original, they go first
+    for (int i = 0; i < m_recentOrder.size() && m_recentOriginalBytes + m_recentDerivedBytes > gs_recentBudget; ++i) {
+        Recent &recent = m_recent[m_recentOrder.at(i)];
+        m_recentDerivedBytes -= derivedBytes(recent.original, recent.derived);
+        recent.derived = QImage();
+        recent.derivation.clear();
+    }
+    while (!m_recentOrder.isEmpty() && m_recentOriginalBytes + m_recentDerivedBytes > gs_recentBudget) {
+        forgetRecent(m_recentOrder.first());
+    }
+}
+
+bool ImagePreloader::isDecoding(const QString &imagePath) const {
+    QMutexLocker locker(&m_mutex);
+    return m_running.contains(imagePath);
+}
+
+bool ImagePreloader::wait(const QString &imagePath, unsigned long msecs) {
+    QMutexLocker locker(&m_mutex);
+    if (m_running.contains(imagePath)) {
+        m_finished.wait(&m_mutex, msecs);
+    }
+    return !m_running.contains(imagePath);
+}
+
+void ImagePreloader::decode() {
+    forever {
+        m_mutex.lock();
+        while (m_jobs.isEmpty() && !m_quit) {
+            m_wake.wait(&m_mutex);
+        }
+        if (m_quit) {
+            m_mutex.unlock();
+            return;
+        }
+        const QString imagePath = m_jobs.takeFirst();
+        const bool exifRotation = m_exifRotation;
+        m_running.insert(imagePath);
+        m_mutex.unlock();
+
+        QImageReader imageReader(imagePath);
+        const QSize size = imageReader.size();
+        const qint64 estimate = qint64(size.width()) * size.height() * 4;
+        bool decodeIt = size.isValid() && !imageReader.supportsAnimation() &&
+                        qint64(size.width()) * size.height() <= gs_maxPixels;
+
+        m_mutex.lock();
+        decodeIt = decodeIt && m_wanted.contains(imagePath) &&
+                   m_decodedBytes + m_runningBytes + estimate <= gs_memoryBudget;
+        if (decodeIt) {
+            m_runningBytes += estimate;
+        }
+        m_mutex.unlock();
+
+        Decoded decoded;
+        if (decodeIt) {
+            decoded.lastModified = QFileInfo(imagePath).lastModified();
+            if (imageReader.read(&decoded.image) && exifRotation) {
+                // not cache(), that one isn't threadsafe
+                Metadata::prefetch(imagePath);
+                decoded.image = decoded.image.transformed(Metadata::transformation(imagePath), Qt::SmoothTransformation);
+            }
+        }
+
+        m_mutex.lock();
+        if (decodeIt) {
+            m_runningBytes -= estimate;
+        }
+        m_running.remove(imagePath);
+        if (!decoded.image.isNull() && m_wanted.contains(imagePath)) {
+            m_decoded.insert(imagePath, decoded);
+            m_decodedBytes += decoded.image.sizeInBytes();
+        }
+        m_finished.wakeAll();
+        m_mutex.unlock();
+    }
+}
@@ -0,0 +1,86 @@
+/*
+ *  Copyright (C) 2013-2018 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMAGE_PRELOADER_H
+#define IMAGE_PRELOADER_H
+
+class QThread;
+#include <QDateTime>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QSet>
+#include <QStringList>
+#include <QWaitCondition>
+
+// Decodes the images the viewer will likely show next on background threads
+// and holds on to the ones it recently showed
+class ImagePreloader {
+
+public:
+    ImagePreloader();
+    ~ImagePreloader();
+    // decode these in order of priority, anything else is dropped or cancelled
+    void setQueue(const QStringList &imagePaths);
+    // the decoded and exif transformed image or a null image
+    QImage take(const QString &imagePath);
+    // the viewer image derived from that, if it was derived the same way
+    QImage takeDerived(const QString &imagePath, const QByteArray &derivation);
+    // remember an image the viewer is done with
+    void keep(const QString &imagePath, const QDateTime &lastModified,
+              const QImage &original, const QImage &derived, const QByteArray &derivation);
+    bool isDecoding(const QString &imagePath) const;
+    // true once imagePath isn't decoding anymore
+    bool wait(const QString &imagePath, unsigned long msecs);
+
+private:
+    struct Decoded {
+        QImage image;
+        QDateTime lastModified;
+    };
+
+    struct Recent {
+        QImage original;
+        QImage derived;
+        QByteArray derivation;
+        QDateTime lastModified;
+    };
+
+    void decode();
+    void evictRecent();
+    void forgetRecent(const QString &imagePath);
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_wake;
+    QWaitCondition m_finished;
+    QStringList m_wanted;
+    QStringList m_jobs;
+    QSet<QString> m_running;
+    QHash<QString, Decoded> m_decoded;
+    qint64 m_decodedBytes = 0;
+    qint64 m_runningBytes = 0;
+    QHash<QString, Recent> m_recent;
+    QStringList m_recentOrder; // least recently used first
+    qint64 m_recentOriginalBytes = 0;
+    qint64 m_recentDerivedBytes = 0;
+    bool m_exifRotation = false;
+    bool m_quit = false;
+    QList<QThread*> m_decoders;
+};
+
+#endif // IMAGE_PRELOADER_H
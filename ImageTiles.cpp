@@ -0,0 +1,128 @@
+/*
+ *  Copyright (C) 2013-2018 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QDebug>
+#include <QImageReader>
+#include <QThread>
+#include "ImageTiles.h"
+
+// 128MB of tiles, several screens worth
+static const int gs_maxTiles = 128;
+
+static inline quint64 tileKey(int level, int column, int row) {
+    return (quint64(level) << 48) | (quint64(row) << 24) | quint64(column);
+}
+
+ImageTiles::ImageTiles(const QString &imagePath, const QSize &imageSize, QObject *parent)
+    : QObject(parent), m_imagePath(imagePath), m_imageSize(imageSize)
+{
+    m_decoder = QThread::create([=]() { decode(); });
+    m_decoder->start(QThread::LowPriority);
+}
+
+ImageTiles::~ImageTiles() {
+    m_mutex.lock();
+    m_quit = true;
+    m_jobs.clear();
+    m_wake.wakeAll();
+    m_mutex.unlock();
+    m_decoder->wait();
+    delete m_decoder;
+}
+
+void ImageTiles::dispose() {
+    disconnect(this, &ImageTiles::tileReady, nullptr, nullptr);
+    setParent(nullptr);
+    m_mutex.lock();
+    m_quit = true;
+    m_jobs.clear();
+    m_wake.wakeAll();
+    m_mutex.unlock();
+    connect(m_decoder, &QThread::finished, this, &QObject::deleteLater);
+    if (m_decoder->isFinished()) {
+        deleteLater();
+    }
+}
+
+void ImageTiles::beginFrame() {
+    QMutexLocker locker(&m_mutex);
+    m_jobs.clear();
+}
+
+QImage ImageTiles::tile(int level, int column, int row) {
+    const quint64 key = tileKey(level, column, row);
+    QMutexLocker locker(&m_mutex);
+    QHash<quint64, QImage>::const_iterator it = m_tiles.constFind(key);
+    if (it != m_tiles.constEnd()) {
+        m_order.removeOne(key);
+        m_order.append(key);
+        return *it;
+    }
+    if (!m_running.contains(key) && !m_jobs.contains(key)) {
+        m_jobs.append(key);
+        m_wake.wakeOne();
+    }
+    return QImage();
+}
+
+void ImageTiles::decode() {
+    forever {
+        m_mutex.lock();
+        while (m_jobs.isEmpty() && !m_quit) {
+            m_wake.wait(&m_mutex);
+        }
+        if (m_quit) {
+            m_mutex.unlock();
+            return;
+        }
+        const quint64 key = m_jobs.takeFirst();
+        m_running.insert(key);
+        m_mutex.unlock();
+
+        const int level = key >> 48;
+        const int row = (key >> 24) & 0xffffff;
+        const int column = key & 0xffffff;
+        const int span = TileSize << level;
+        const QRect clip = QRect(column * span, row * span, span, span).intersected(QRect(QPoint(0, 0), m_imageSize));
+
+        QImage tile;
+        if (!clip.isEmpty()) {
+            QImageReader reader(m_imagePath);
+            reader.setClipRect(clip);
+            reader.setScaledSize(QSize(qMax(1, clip.width() >> level), qMax(1, clip.height() >> level)));
+            if (!reader.read(&tile)) {
+                qWarning() << "Failed to decode tile" << clip << "of" << m_imagePath << reader.errorString();
+            }
+        }
+
+        m_mutex.lock();
+        m_running.remove(key);
+        if (!tile.isNull()) {
+            m_tiles.insert(key, tile);
+            m_order.append(key);
+            while (m_order.size() > gs_maxTiles) {
+                m_tiles.remove(m_order.takeFirst());
+            }
+        }
+        m_mutex.unlock();
+
+        if (!tile.isNull()) {
+            QMetaObject::invokeMethod(this, "tileReady", Qt::QueuedConnection);
+        }
+    }
+}
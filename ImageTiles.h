@@ -0,0 +1,66 @@
+/*
+ *  Copyright (C) 2013-2018 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMAGE_TILES_H
+#define IMAGE_TILES_H
+
+class QThread;
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QSet>
+#include <QWaitCondition>
+
+// Decodes regions of an image too large to be held in memory as a whole.
+// Tiles are TileSize pixels wide on every level, level n covers 2^n image pixels per tile pixel.
+class ImageTiles : public QObject {
+Q_OBJECT
+
+public:
+    enum { TileSize = 512 };
+
+    ImageTiles(const QString &imagePath, const QSize &imageSize, QObject *parent = nullptr);
+    ~ImageTiles();
+    // stop decoding and delete once the current tile is done, so big regions don't block the caller
+    void dispose();
+    const QSize &imageSize() const { return m_imageSize; }
+    // drop requests that were not repeated since
+    void beginFrame();
+    // the tile or a null image, in which case it gets decoded in the background
+    QImage tile(int level, int column, int row);
+
+signals:
+    void tileReady();
+
+private:
+    void decode();
+
+    const QString m_imagePath;
+    const QSize m_imageSize;
+    QMutex m_mutex;
+    QWaitCondition m_wake;
+    QList<quint64> m_jobs;
+    QSet<quint64> m_running;
+    QHash<quint64, QImage> m_tiles;
+    QList<quint64> m_order; // least recently used first
+    bool m_quit = false;
+    QThread *m_decoder;
+};
+
+#endif // IMAGE_TILES_H
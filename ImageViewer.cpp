@@ -22,6 +22,7 @@
 #include <QDir>
 #include <QFileDialog>
 #include <QFileInfo>
+#include <QImageIOHandler>
 #include <QImageReader>
 #include <QLabel>
 #include <QLoggingCategory>
@@ -30,16 +31,25 @@
 #include <QMovie>
 #include <QPainter>
 #include <QScrollBar>
+#include <QSemaphore>
+#include <QSharedPointer>
 #include <QThread>
+#include <QThreadPool>
 #include <QTimer>
 #include <QWheelEvent>
+#include <cmath>
+#include <functional>
 
+#include "BatchTransform.h"
 #include "CropDialog.h"
 #include "CropRubberband.h"
+#include "ImagePreloader.h"
+#include "ImageTiles.h"
 #include "ImageWidget.h"
 #include "ImageViewer.h"
 #include "MessageBox.h"
 #include "MetadataCache.h"
+#include "MetadataWriter.h"
 #include "Settings.h"
 
 
@@ -158,6 +168,11 @@ ImageViewer::ImageViewer(QWidget *parent) : QScrollArea(parent) {
 
     newImage = false;
     cropRubberBand = 0;
+    m_preloader = new ImagePreloader;
+}
+
+ImageViewer::~ImageViewer() {
+    delete m_preloader;
 }
 
 static unsigned int getHeightByWidth(int imgWidth, int imgHeight, int newWidth) {
@@ -177,7 +192,7 @@ void ImageViewer::resizeImage(QPoint focus) {
     if (busy)
         return;
 
-    QSize imageSize = animation ? animation->currentPixmap().size() : imageWidget->image().size();
+    QSize imageSize = animation ? animation->currentPixmap().size() : imageWidget->sourceSize();
     if (imageSize.isEmpty())
         return;
 
@@ -283,6 +298,11 @@ void ImageViewer::resizeImage(QPoint focus) {
             imageWidget->setImagePosition(QPoint(x,y));
         }
         imageWidget->setImageSize(imageSize);
+        // zoomed past the resolution of the colour preview
+        if (Settings::colorsActive && imageWidget->image().size() != imageWidget->sourceSize() &&
+            imageSize.width() * devicePixelRatioF() > imageWidget->image().width()) {
+            QTimer::singleShot(0, this, &ImageViewer::previewColors);
+        }
     } else {
         widget()->setFixedSize(imageSize);
 //        widget()->adjustSize();
@@ -298,8 +318,31 @@ void ImageViewer::resizeImage(QPoint focus) {
     busy = false;
 }
 
+// Crops, rotations, flips and resizes are kept as one transformation of the image they started from, so
+// that a chain of them is rendered in a single pass and resampled once rather than once per step.
+void ImageViewer::applyEdit(const QTransform &edit, const QSize &size) {
+    if (m_editSource.isNull() || origImage.cacheKey() != m_editResultKey) {
+        // origImage was replaced since the last edit, start over from it
+        m_editSource = origImage;
+        m_editTransform = QTransform();
+    }
+    m_editTransform *= edit;
+
+    origImage = BatchTransform::render(m_editSource, m_editTransform, size);
+    m_editResultKey = origImage.cacheKey();
+
+    // a crop or flip copies the pixels it keeps unchanged, the next edit may as well start from the
+    // result and the source copy is only held on to while a chain has resampled the image
+    const QTransform &t = m_editTransform;
+    if (qAbs(t.m11()) == 1.0 && qAbs(t.m22()) == 1.0 && t.m12() == 0.0 && t.m21() == 0.0 &&
+        t.type() <= QTransform::TxScale && t.dx() == std::round(t.dx()) && t.dy() == std::round(t.dy())) {
+        m_editSource = QImage();
+    }
+}
+
 void ImageViewer::scaleImage(QSize newSize) {
-    origImage = origImage.scaled(newSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    applyEdit(QTransform::fromScale(qreal(newSize.width()) / origImage.width(),
+                                    qreal(newSize.height()) / origImage.height()), newSize);
     refresh();
     setFeedback(tr("New image size: %1x%2").arg(origImage.width()).arg(origImage.height()));
 }
@@ -399,8 +442,8 @@ static inline int bound0To255(int val) {
     return ((val > 255) ? 255 : (val < 0) ? 0 : val);
 }
 
-static inline int hslValue(double n1, double n2, double hue) {
-    double value;
+static inline int hslValue(float n1, float n2, float hue) {
+    float value;
 
     if (hue > 255) {
         hue -= 255;
@@ -408,21 +451,21 @@ static inline int hslValue(double n1, double n2, double hue) {
         hue += 255;
     }
 
-    if (hue < 42.5) {
-        value = n1 + (n2 - n1) * (hue / 42.5);
-    } else if (hue < 127.5) {
+    if (hue < 42.5f) {
+        value = n1 + (n2 - n1) * (hue / 42.5f);
+    } else if (hue < 127.5f) {
         value = n2;
     } else if (hue < 170) {
-        value = n1 + (n2 - n1) * ((170 - hue) / 42.5);
+        value = n1 + (n2 - n1) * ((170 - hue) / 42.5f);
     } else {
         value = n1;
     }
 
-    return ROUND(value * 255.0);
+    return ROUND(value * 255.0f);
 }
 
-void rgbToHsl(int r, int g, int b, unsigned char *hue, unsigned char *sat, unsigned char *light) {
-    double h, s, l;
+static inline void rgbToHsl(int r, int g, int b, unsigned char *hue, unsigned char *sat, unsigned char *light) {
+    float h, s, l;
     int min, max;
     int delta;
 
@@ -434,29 +477,29 @@ void rgbToHsl(int r, int g, int b, unsigned char *hue, unsigned char *sat, unsig
         min = MIN(r, b);
     }
 
-    l = (max + min) / 2.0;
+    l = (max + min) / 2.0f;
 
     if (max == min) {
-        s = 0.0;
-        h = 0.0;
+        s = 0.0f;
+        h = 0.0f;
     } else {
         delta = (max - min);
 
         if (l < 128) {
-            s = 255 * (double) delta / (double) (max + min);
+            s = 255 * (float) delta / (float) (max + min);
         } else {
-            s = 255 * (double) delta / (double) (511 - max - min);
+            s = 255 * (float) delta / (float) (511 - max - min);
         }
 
         if (r == max) {
-            h = (g - b) / (double) delta;
+            h = (g - b) / (float) delta;
         } else if (g == max) {
-            h = 2 + (b - r) / (double) delta;
+            h = 2 + (b - r) / (float) delta;
         } else {
-            h = 4 + (r - g) / (double) delta;
+            h = 4 + (r - g) / (float) delta;
         }
 
-        h = h * 42.5;
+        h = h * 42.5f;
         if (h < 0) {
             h += 255;
         } else if (h > 255) {
@@ -469,22 +512,22 @@ void rgbToHsl(int r, int g, int b, unsigned char *hue, unsigned char *sat, unsig
     *light = ROUND(l);
 }
 
-void hslToRgb(double h, double s, double l,
-              unsigned char *red, unsigned char *green, unsigned char *blue) {
+static inline void hslToRgb(float h, float s, float l,
+                            unsigned char *red, unsigned char *green, unsigned char *blue) {
     if (s == 0) {
         /* achromatic case */
         *red = l;
         *green = l;
         *blue = l;
     } else {
-        double m1, m2;
+        float m1, m2;
 
         if (l < 128)
-            m2 = (l * (255 + s)) / 65025.0;
+            m2 = (l * (255 + s)) / 65025.0f;
         else
-            m2 = (l + s - (l * s) / 255.0) / 255.0;
+            m2 = (l + s - (l * s) / 255.0f) / 255.0f;
 
-        m1 = (l / 127.5) - m2;
+        m1 = (l / 127.5f) - m2;
 
         /* chromatic case */
         *red = hslValue(m1, m2, h + 85);
@@ -493,15 +536,30 @@ void hslToRgb(double h, double s, double l,
     }
 }
 
+// Runs work(first, end) for bands of scanlines on the global thread pool and returns when they're done
+static void forEachBand(int height, const std::function<void(int, int)> &work) {
+    const int bands = qBound(1, qMin(QThreadPool::globalInstance()->maxThreadCount(), height / 64), 16);
+    const int bandHeight = (height + bands - 1) / bands;
+    QSemaphore done;
+    int started = 0;
+    for (int band = 1; band < bands; ++band) {
+        const int first = band * bandHeight;
+        const int end = qMin(height, first + bandHeight);
+        if (first >= end) {
+            break;
+        }
+        QThreadPool::globalInstance()->start([&work, &done, first, end]() {
+            work(first, end);
+            done.release();
+        });
+        ++started;
+    }
+    work(0, qMin(height, bandHeight));
+    done.acquire(started);
+}
+
 void ImageViewer::colorize() {
-    int y, x;
-    unsigned char hr, hg, hb;
-    int r, g, b;
-    QRgb *line;
-    unsigned char h, s, l;
-    static unsigned char contrastTransform[256];
-    static unsigned char brightTransform[256];
-    bool hasAlpha = viewerImage.hasAlphaChannel();
+    const bool hasAlpha = viewerImage.hasAlphaChannel();
 
     switch(viewerImage.format()) {
     case QImage::Format_RGB32:
@@ -514,6 +572,8 @@ void ImageViewer::colorize() {
     }
 
     int i;
+    unsigned char contrastTransform[256];
+    unsigned char brightTransform[256];
     float contrast = ((float) Settings::contrastVal / 100.0);
     float brightness = ((float) Settings::brightVal / 100.0);
 
@@ -531,43 +591,116 @@ void ImageViewer::colorize() {
         brightTransform[i] = MIN(255, (int) ((255.0 * pow(i / 255.0, 1.0 / brightness)) + 0.5));
     }
 
-    for (y = 0; y < viewerImage.height(); ++y) {
+    // negation, gain, brightness and contrast folded into one table per channel
+    unsigned char redTransform[256], greenTransform[256], blueTransform[256];
+    unsigned char *channelTransforms[3] = { redTransform, greenTransform, blueTransform };
+    const bool negate[3] = { Settings::rNegateEnabled, Settings::gNegateEnabled, Settings::bNegateEnabled };
+    const int gain[3] = { Settings::redVal, Settings::greenVal, Settings::blueVal };
+    for (int channel = 0; channel < 3; ++channel) {
+        for (i = 0; i < 256; ++i) {
+            int value = negate[channel] ? 255 - i : i;
+            value = bound0To255((value * (gain[channel] + 100)) / 100);
+            channelTransforms[channel][i] = contrastTransform[brightTransform[value]];
+        }
+    }
+
+    unsigned char hueTransform[256], saturationTransform[256], lightnessTransform[256];
+    for (i = 0; i < 256; ++i) {
+        hueTransform[i] = Settings::colorizeEnabled ? Settings::hueVal : i + Settings::hueVal;
+        saturationTransform[i] = bound0To255((i * Settings::saturationVal) / 100);
+        lightnessTransform[i] = bound0To255((i * Settings::lightnessVal) / 100);
+    }
+    // the round trip through HSL is only worth it when it changes something
+    const bool hslIdentity = !Settings::colorizeEnabled && (Settings::hueVal & 0xff) == 0 &&
+                             Settings::saturationVal == 100 && Settings::lightnessVal == 100;
+    const bool hueRed = Settings::hueRedChannel;
+    const bool hueGreen = Settings::hueGreenChannel;
+    const bool hueBlue = Settings::hueBlueChannel;
+
+    const int width = viewerImage.width();
+    // bits() detaches once here; the bands only touch their own rows of this buffer
+    uchar *bits = viewerImage.bits();
+    const qsizetype bytesPerLine = viewerImage.bytesPerLine();
+    forEachBand(viewerImage.height(), [&](int first, int end) {
+        unsigned char hr, hg, hb;
+        unsigned char h, s, l;
+        for (int y = first; y < end; ++y) {
+            QRgb *line = (QRgb *) (bits + y * bytesPerLine);
+            for (int x = 0; x < width; ++x) {
+                const QRgb pixel = line[x];
+                hr = redTransform[qRed(pixel)];
+                hg = greenTransform[qGreen(pixel)];
+                hb = blueTransform[qBlue(pixel)];
+
+                if (!hslIdentity) {
+                    rgbToHsl(hr, hg, hb, &h, &s, &l);
+                    hslToRgb(hueTransform[h], saturationTransform[s], lightnessTransform[l], &hr, &hg, &hb);
+                }
 
-        line = (QRgb *) viewerImage.scanLine(y);
-        for (x = 0; x < viewerImage.width(); ++x) {
-            r = Settings::rNegateEnabled ? bound0To255(255 - qRed(line[x])) : qRed(line[x]);
-            g = Settings::gNegateEnabled ? bound0To255(255 - qGreen(line[x])) : qGreen(line[x]);
-            b = Settings::bNegateEnabled ? bound0To255(255 - qBlue(line[x])) : qBlue(line[x]);
+                const int r = hueRed ? hr : qRed(pixel);
+                const int g = hueGreen ? hg : qGreen(pixel);
+                const int b = hueBlue ? hb : qBlue(pixel);
 
-            r = bound0To255((r * (Settings::redVal + 100)) / 100);
-            g = bound0To255((g * (Settings::greenVal + 100)) / 100);
-            b = bound0To255((b * (Settings::blueVal + 100)) / 100);
+                if (hasAlpha) {
+                    line[x] = qRgba(r, g, b, qAlpha(pixel));
+                } else {
+                    line[x] = qRgb(r, g, b);
+                }
+            }
+        }
+    });
+}
 
-            r = bound0To255(brightTransform[r]);
-            g = bound0To255(brightTransform[g]);
-            b = bound0To255(brightTransform[b]);
+// Everything colorize() and mirror() make of origImage depends on
+QByteArray ImageViewer::derivation() const {
+    QByteArray key = "mirror:" + QByteArray::number(myMirrorLayout);
+    if (Settings::colorsActive || Settings::keepTransform) {
+        const int values[] = { Settings::hueVal, Settings::saturationVal, Settings::lightnessVal,
+                               Settings::contrastVal, Settings::brightVal,
+                               Settings::redVal, Settings::greenVal, Settings::blueVal,
+                               Settings::colorizeEnabled, Settings::rNegateEnabled,
+                               Settings::gNegateEnabled, Settings::bNegateEnabled,
+                               Settings::hueRedChannel, Settings::hueGreenChannel, Settings::hueBlueChannel };
+        key += " colors:";
+        for (int value : values) {
+            key += QByteArray::number(value) + ',';
+        }
+    }
+    return key;
+}
 
-            r = bound0To255(contrastTransform[r]);
-            g = bound0To255(contrastTransform[g]);
-            b = bound0To255(contrastTransform[b]);
+// Colour adjustments of the full image only happen once the dialog is done,
+// while the sliders move they're applied to a display sized copy
+void ImageViewer::previewColors() {
+    if (!imageWidget) {
+        return;
+    }
 
-            rgbToHsl(r, g, b, &h, &s, &l);
-            h = Settings::colorizeEnabled ? Settings::hueVal : h + Settings::hueVal;
-            s = bound0To255(((s * Settings::saturationVal) / 100));
-            l = bound0To255(((l * Settings::lightnessVal) / 100));
-            hslToRgb(h, s, l, &hr, &hg, &hb);
+    const qreal scale = devicePixelRatioF() * imageWidget->imageSize().width() / imageWidget->sourceSize().width();
+    if (scale >= 1.0 || origImage.isNull()) {
+        refresh();
+        return;
+    }
 
-            r = Settings::hueRedChannel ? hr : qRed(line[x]);
-            g = Settings::hueGreenChannel ? hg : qGreen(line[x]);
-            b = Settings::hueBlueChannel ? hb : qBlue(line[x]);
+    const QSize proxySize = origImage.size() * scale;
+    if (m_colorProxySource != origImage.cacheKey() || m_colorProxy.size() != proxySize) {
+        m_colorProxySource = origImage.cacheKey();
+        m_colorProxy = origImage.scaled(proxySize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
 
-            if (hasAlpha) {
-                line[x] = qRgba(r, g, b, qAlpha(line[x]));
-            } else {
-                line[x] = qRgb(r, g, b);
-            }
-        }
+    const QImage fullImage = viewerImage;
+    viewerImage = m_colorProxy;
+    colorize();
+    if (myMirrorLayout) {
+        mirror();
     }
+    const qreal ratio = qreal(origImage.width()) / m_colorProxy.width();
+    const QSize sourceSize(qRound(viewerImage.width() * ratio), qRound(viewerImage.height() * ratio));
+    const QSize displaySize = imageWidget->imageSize();
+    imageWidget->setImage(viewerImage, m_exifTransformation, sourceSize);
+    imageWidget->setImageSize(displaySize);
+    viewerImage = fullImage;
+    resizeImage();
 }
 
 void ImageViewer::refresh() {
@@ -575,6 +708,9 @@ void ImageViewer::refresh() {
         return;
     }
 
+    m_colorProxy = QImage();
+    m_colorProxySource = 0;
+
     viewerImage = origImage;
 
     if (Settings::colorsActive || Settings::keepTransform) {
@@ -671,11 +807,32 @@ void ImageViewer::reload() {
     }
 
     // It's not a movie
-    if (fullImagePath == m_preloadedPath) {
-        viewerImage = origImage = m_preloadedImage;
-        m_preloadedImage = QImage();
-        m_preloadedPath.clear();
-    } else if (imageReader.size().isValid()) {
+    bool imageOk = false;
+    const QSize fileSize = imageReader.size();
+    // previews are shown with it as well, so it has to be this image's before any of them
+    m_exifTransformation = Settings::exifRotationEnabled ? Metadata::transformation(fullImagePath) : QTransform();
+    if (!batchMode) {
+        // the image we want might be on its way already, it won't get any faster by starting over
+        s_busy = true;
+        while (!m_preloader->wait(fullImagePath, 30)) {
+            QApplication::processEvents();
+            if (s_abort) {
+                break;
+            }
+        }
+        s_busy = false;
+        if (s_abort) {
+            s_abort = false;
+            return;
+        }
+        origImage = m_preloader->take(fullImagePath);
+        imageOk = !origImage.isNull();
+    }
+    m_decodedImageKey = 0;
+    m_editSource = QImage();
+
+    // preloaded images are exif transformed already
+    if (!imageOk && imageReader.size().isValid()) {
         QSize sz = imageReader.size();
         if (sz.width() * sz.height() > 8192*8192) { // allocation limit
             /// @todo this and the correct sqrt(double…) of the below still runs into the size limts?
@@ -692,14 +849,41 @@ void ImageViewer::reload() {
                             .arg(imageReader.size().width()).arg(imageReader.size().height())
                             .arg(sz.width()).arg(sz.height()), 10000);
         }
-        bool imageOk = false;
         if (batchMode || Settings::slideShowActive) {
-            imageReader.read(&origImage);
+            imageOk = imageReader.read(&origImage);
         } else {
             QThread *thread = QThread::create([&](){imageOk = imageReader.read(&origImage);});
             thread->start();
+
+            // Big images take a while, show a screen sized decode meanwhile. Readers that can scale
+            // while decoding (jpeg) produce that for a fraction of the cost of the full image.
+            // The preview thread may outlive this call when the full decode wins, it owns its share of the
+            // result and gets rid of itself once done
+            QSharedPointer<QImage> preview;
+            QPointer<QThread> previewThread;
+            const int side = qMax(width(), height()) * devicePixelRatioF();
+            if (qint64(sz.width()) * sz.height() > 4 * qint64(side) * side &&
+                imageReader.supportsOption(QImageIOHandler::ScaledSize)) {
+                const QString previewPath = fullImagePath;
+                const QSize previewSize = sz.scaled(side, side, Qt::KeepAspectRatio);
+                preview = QSharedPointer<QImage>::create();
+                previewThread = QThread::create([preview, previewPath, previewSize]() {
+                    QImageReader previewReader(previewPath);
+                    previewReader.setScaledSize(previewSize);
+                    previewReader.read(preview.data());
+                });
+                connect(previewThread, &QThread::finished, previewThread, &QObject::deleteLater);
+                previewThread->start();
+            }
+
             s_busy = true;
             while (!thread->wait(30)) {
+                if (preview && (!previewThread || previewThread->isFinished())) {
+                    if (!preview->isNull()) {
+                        showPreview(preview->transformed(m_exifTransformation, Qt::SmoothTransformation));
+                    }
+                    preview.reset();
+                }
                 QApplication::processEvents();
                 if (s_abort) {
                     thread->terminate();
@@ -715,11 +899,16 @@ void ImageViewer::reload() {
             }
         }
 
-        if (imageOk) {
-            if (Settings::exifRotationEnabled) {
-                m_exifTransformation = Metadata::transformation(fullImagePath);
-                origImage = origImage.transformed(Metadata::transformation(fullImagePath), Qt::SmoothTransformation);
-            }
+        if (imageOk && Settings::exifRotationEnabled) {
+            origImage = origImage.transformed(m_exifTransformation, Qt::SmoothTransformation);
+        }
+    }
+
+    if (imageOk) {
+        m_decodedImageKey = origImage.cacheKey();
+        m_decodedLastModified = QFileInfo(fullImagePath).lastModified();
+        viewerImage = batchMode ? QImage() : m_preloader->takeDerived(fullImagePath, derivation());
+        if (viewerImage.isNull()) {
             viewerImage = origImage;
 
             if (Settings::colorsActive || Settings::keepTransform) {
@@ -728,14 +917,21 @@ void ImageViewer::reload() {
             if (myMirrorLayout) {
                 mirror();
             }
-        } else {
-            viewerImage = QIcon::fromTheme("image-missing",
-                                        QIcon(":/images/error_image.png")).pixmap(BAD_IMAGE_SIZE, BAD_IMAGE_SIZE).toImage();
-            setInfo(QFileInfo(imageReader.fileName()).fileName() + ": " + imageReader.errorString());
         }
+    } else if (imageReader.size().isValid()) {
+        viewerImage = QIcon::fromTheme("image-missing",
+                                    QIcon(":/images/error_image.png")).pixmap(BAD_IMAGE_SIZE, BAD_IMAGE_SIZE).toImage();
+        setInfo(QFileInfo(imageReader.fileName()).fileName() + ": " + imageReader.errorString());
     }
 
     setImage(viewerImage);
+    // The overview of an oversized image lacks detail when zoomed in, fetch that from the file on demand.
+    // Readers without clip support would decode the whole image per region, orientation is not accounted for
+    if (!batchMode && imageOk && viewerImage.cacheKey() == origImage.cacheKey() &&
+        qint64(fileSize.width()) * fileSize.height() > 8192*8192 && origImage.size() != fileSize &&
+        m_exifTransformation.isIdentity() && imageReader.supportsOption(QImageIOHandler::ClipRect)) {
+        imageWidget->setTiles(new ImageTiles(fullImagePath, fileSize));
+    }
     resizeImage();
     centerImage(imageWidget->imageSize());
     if (Settings::keepTransform) {
@@ -787,6 +983,12 @@ void ImageViewer::loadImage(QString imageFileName, const QImage &preview) {
     if (fullImagePath == imageFileName)
         return;
 
+    // unless it was edited, keep what we're leaving in case we come back
+    if (!batchMode && m_decodedImageKey && origImage.cacheKey() == m_decodedImageKey) {
+        m_preloader->keep(fullImagePath, m_decodedLastModified, origImage, viewerImage, derivation());
+    }
+    m_decodedImageKey = 0;
+
     unsetFeedback();
     newImage = false;
     fullImagePath = imageFileName;
@@ -796,18 +998,13 @@ void ImageViewer::loadImage(QString imageFileName, const QImage &preview) {
         Settings::imageZoomFactor = 1.0;
     }
     if (!preview.isNull()) {
+        // the thumbnail is oriented already, but the widget needs to know how
+        m_exifTransformation = Settings::exifRotationEnabled ? Metadata::transformation(fullImagePath) : QTransform();
         QSize fullSize = QImageReader(fullImagePath).size();
         // don't preview small images w/ a huge thumbnail upscale
         // it's pointless and causes ugly flicker
         if (!fullSize.isValid() || (fullSize.width() > 4*width()/5 && fullSize.height() > 4*height()/5)) {
-            setImage(preview);
-            const int zif = Settings::zoomInFlags;
-            const bool disRes = tempDisableResize;
-            tempDisableResize = false;
-            Settings::zoomInFlags = WidthAndHeight;
-            resizeImage();
-            Settings::zoomInFlags = zif;
-            tempDisableResize = disRes;
+            showPreview(preview);
         }
     }
 
@@ -815,31 +1012,20 @@ void ImageViewer::loadImage(QString imageFileName, const QImage &preview) {
     reload();
 }
 
-void ImageViewer::preload(QString imageFileName) {
-    if (m_preloadedPath == imageFileName)
-        return;
-
-    m_preloadedPath = imageFileName;
-    // reload current one - maybe the file has changed on disk?
-    /*if (m_preloadedPath == fullImagePath) {
-        m_preloadedImage = origImage;
-        return;
-    }*/
+// Shows a stand-in for the image that is still loading, fit to the window like the real one will be
+void ImageViewer::showPreview(const QImage &preview) {
+    setImage(preview);
+    const int zif = Settings::zoomInFlags;
+    const bool disRes = tempDisableResize;
+    tempDisableResize = false;
+    Settings::zoomInFlags = WidthAndHeight;
+    resizeImage();
+    Settings::zoomInFlags = zif;
+    tempDisableResize = disRes;
+}
 
-    QImageReader imageReader(m_preloadedPath);
-    if (imageReader.supportsAnimation()) {
-        m_preloadedImage = QImage();
-        m_preloadedPath.clear();
-        return; // no preloading animations
-    }
-    if (imageReader.size().isValid() && imageReader.read(&m_preloadedImage)) {
-        if (Settings::exifRotationEnabled) {
-            m_preloadedImage = m_preloadedImage.transformed(Metadata::transformation(fullImagePath), Qt::SmoothTransformation);
-        }
-    } else {
-        m_preloadedImage = QImage();
-        m_preloadedPath.clear();
-    }
+void ImageViewer::preload(const QStringList &imageFileNames) {
+    m_preloader->setQueue(imageFileNames);
 }
 
 void ImageViewer::clearImage() {
@@ -944,10 +1130,14 @@ void ImageViewer::updateRubberBandFeedback(QRect geom) {
     if (!imageWidget) {
         return;
     }
+    imageWidget->interact();
     bool ok;
     QTransform matrix = imageWidget->transformation().inverted(&ok);
     if (!ok)
         qDebug() << "something's fucked up about the transformation matrix!";
+    // remembered for replaying the crop on other images
+    m_batchCropRect = cropGeometry(&m_batchCropRotating);
+    m_batchReferenceSize = origImage.size();
     m_isoCropRect = geom = matrix.mapRect(geom);
     setFeedback(tr("Selection: ") + QString("%1x%2").arg(geom.width()).arg(geom.height())
                                   + QString(geom.x() < 0 ? "%1" : "+%1").arg(geom.x())
@@ -965,68 +1155,89 @@ void ImageViewer::updateRubberBandFeedback(QRect geom) {
     doubleclickhint->start();
 }
 
-void ImageViewer::applyCropAndRotation() {
-    if (!imageWidget || ! cropRubberBand)
-        return;
+// Crops rect out of an image, rotated around its center and flipped the way the viewer shows it
+static QTransform cropTransform(const QRect &rect, qreal rotation, bool flipH, bool flipV) {
+    QTransform edit;
+    if (rotation != 0.0) {
+        // rotate in relation to the paint device
+        QPoint center(rect.width() / 2, rect.height() / 2);
+        edit.translate(center.x(), center.y());
+        // onedirectional flipping inverts the rotation
+        if (flipH xor flipV)
+            edit.rotate(360.0 - rotation);
+        else
+            edit.rotate(rotation);
+        edit.translate(-center.x(), -center.y());
+    }
 
-    cropRubberBand->hide();
+    // offset by crop rect
+    edit.translate(-rect.x(), -rect.y());
 
+    // apply flip-flop
+    edit *= QTransform(flipH ? -1 : 1, 0, 0, flipV ? -1 : 1, flipH ? rect.width() : 0, flipV ? rect.height() : 0);
+    return edit;
+}
+
+// The area of origImage the rubber band selects, its size is that of the cropped image
+QRect ImageViewer::cropGeometry(bool *rotating) {
     QTransform matrix = imageWidget->transformation();
     bool ok;
     // the inverted mapping of the crop area matches the coordinates of the original image
     m_isoCropRect = matrix.inverted(&ok).mapRect(cropRubberBand->geometry());
     if (!ok) {
         qDebug() << "something's fucked up about the transformation matrix! Not cropping";
-        return;
+        return QRect();
     }
 
-    if (!matrix.isRotating()) {
+    *rotating = matrix.isRotating();
+    if (!*rotating) {
         // … we can just copy the area, later apply flips and be done
-        origImage = origImage.copy(m_isoCropRect);
-    } else {
-        // The rotated case is more involved. The inverted matrix still maps image coordinates
-        // but that's not what the user sees or expects.
-        //
-        // This is inherently lossy because of the pixel transpositon, so special-case it
-
-        const QSize visualSize = imageWidget->imageSize();
-        float scale = qMax(float(visualSize.width()) / viewerImage.width(), float(visualSize.height()) / viewerImage.height());
-        if (scale <= 0.0) {
-            qDebug() << "something is seriously wrong with the scale, not cropping" << scale;
-            return;
-        }
-
-        // The new image size must be the size of the visible crop area, compensated for the current scale factor
-        QImage target(cropRubberBand->geometry().size()/scale, origImage.format());
-        // but still be at the same position
-        QRect sourceRect = target.rect();
-        sourceRect.moveCenter(m_isoCropRect.center());
+        return m_isoCropRect;
+    }
 
-        target.fill(Qt::black /* Qt::green */);
-        QPainter painter(&target);
-        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    // The rotated case is more involved. The inverted matrix still maps image coordinates
+    // but that's not what the user sees or expects.
+    //
+    // This is inherently lossy because of the pixel transpositon, so special-case it
 
-        // rotate in relation to the paint device
-        QPoint center(target.width() / 2, target.height() / 2);
-        painter.translate(center);
-        // onedirectional flipping inverts the rotation
-        if (Settings::flipH xor Settings::flipV)
-            painter.rotate(360.0 - imageWidget->rotation());
-        else
-            painter.rotate(imageWidget->rotation());
-        painter.translate(-center);
+    const QSize visualSize = imageWidget->imageSize();
+    float scale = qMax(float(visualSize.width()) / viewerImage.width(), float(visualSize.height()) / viewerImage.height());
+    if (scale <= 0.0) {
+        qDebug() << "something is seriously wrong with the scale, not cropping" << scale;
+        return QRect();
+    }
 
-        // offset by crop rect
-        painter.translate(-sourceRect.topLeft());
+    // The new image size must be the size of the visible crop area, compensated for the current scale factor
+    QRect cropRect(QPoint(0, 0), cropRubberBand->geometry().size()/scale);
+    // but still be at the same position
+    cropRect.moveCenter(m_isoCropRect.center());
+    return cropRect;
+}
 
-        // crop
-        painter.drawImage(0,0, origImage);
-        painter.end();
-        origImage = target;
+bool ImageViewer::batchEdit(QTransform *edit, QSize *size, QSize *referenceSize) const {
+    if (m_batchCropRect.isEmpty()) {
+        return false;
     }
+    *edit = cropTransform(m_batchCropRect, m_batchCropRotating ? Settings::rotation : 0.0,
+                          Settings::flipH, Settings::flipV);
+    *size = m_batchCropRect.size();
+    *referenceSize = m_batchReferenceSize;
+    return true;
+}
 
-    // apply flip-flop
-    origImage.mirror(Settings::flipH, Settings::flipV);
+void ImageViewer::applyCropAndRotation() {
+    if (!imageWidget || ! cropRubberBand)
+        return;
+
+    cropRubberBand->hide();
+
+    bool rotating;
+    const QRect cropRect = cropGeometry(&rotating);
+    if (cropRect.isEmpty()) {
+        return;
+    }
+    applyEdit(cropTransform(cropRect, rotating ? imageWidget->rotation() : 0.0, Settings::flipH, Settings::flipV),
+              cropRect.size());
 
     // reset transformations for the new image
     if (!batchMode) {
@@ -1038,6 +1249,7 @@ void ImageViewer::applyCropAndRotation() {
             Settings::imageZoomFactor = 1.0;
         }
         m_isoCropRect = QRect(); // invalidate
+        m_batchCropRect = QRect();
     }
     refresh();
     setFeedback("", false);
@@ -1056,6 +1268,12 @@ void ImageViewer::configureLetterbox() {
     dlg->exec();
 }
 
+void ImageViewer::interact() {
+    if (imageWidget) {
+        imageWidget->interact();
+    }
+}
+
 QSize ImageViewer::currentImageSize() const {
     return origImage.size();
 }
@@ -1084,6 +1302,7 @@ void ImageViewer::mouseMoveEvent(QMouseEvent *event) {
             Settings::rotation -= int(360*Settings::rotation)/360;
         if (Settings::rotation < 0)
             Settings::rotation += 360.0;
+        imageWidget->interact();
         imageWidget->setRotation(Settings::rotation);
         setFeedback(tr("Rotation %1°").arg(Settings::rotation));
         // qDebug() << "image center" << fulcrum << "line" << vector << "angle" << vector.angle() << "geom" << imageWidget->geometry();
@@ -1169,6 +1388,66 @@ void ImageViewer::slideImage(QPoint delta) {
     }
 }
 
+// The rotation and flips the image is shown with
+QTransform ImageViewer::viewTransformation() const {
+    QTransform transformation;
+    transformation.rotate(Settings::rotation);
+    transformation.scale(Settings::flipH ? -1 : 1, Settings::flipV ? -1 : 1);
+    return transformation;
+}
+
+// Quarter turns and flips of an unedited JPEG only need a new Exif orientation,
+// which leaves the compressed image data bit for bit as it is
+bool ImageViewer::saveOrientation(const QString &savePath) {
+    // viewerImage is origImage unless colour adjustments or mirroring were applied to it
+    if (!Settings::losslessRotation || !Settings::exifRotationEnabled || Settings::colorsActive ||
+        viewerImage.cacheKey() != origImage.cacheKey() ||
+        !m_decodedImageKey || origImage.cacheKey() != m_decodedImageKey ||
+        std::fmod(Settings::rotation, 90.0) != 0.0 || QImageReader::imageFormat(fullImagePath) != "jpeg") {
+        return false;
+    }
+
+    const long orientation = Metadata::orientation(m_exifTransformation * viewTransformation());
+    if (!orientation) {
+        return false;
+    }
+
+    // an existing file at savePath is only replaced once its copy has the new orientation
+    QString targetPath = savePath;
+    if (savePath != fullImagePath) {
+        targetPath = savePath + ".phototonic";
+        QFile::remove(targetPath);
+        if (!QFile::copy(fullImagePath, targetPath)) {
+            MessageBox msgBox(this);
+            msgBox.critical(tr("Error"), tr("Failed to save image."));
+            return true;
+        }
+    }
+    MetadataWriter::instance()->setOrientation(targetPath, orientation);
+    MetadataWriter::instance()->flush(targetPath);
+    bool saved = Metadata::orientation(targetPath) == orientation;
+    if (saved && targetPath != savePath) {
+        saved = (!QFile::exists(savePath) || QFile::remove(savePath)) && QFile::rename(targetPath, savePath);
+    }
+    if (!saved) {
+        if (targetPath != savePath) {
+            QFile::remove(targetPath);
+        }
+        MessageBox msgBox(this);
+        msgBox.critical(tr("Error"), tr("Failed to save image."));
+        return true;
+    }
+
+    if (savePath == fullImagePath) {
+        // the file shows the way the viewer did now
+        Settings::rotation = 0;
+        Settings::flipH = Settings::flipV = false;
+    }
+    reload();
+    setFeedback(tr("Image saved."));
+    return true;
+}
+
 void ImageViewer::saveImage() {
 #if __clang__
 #pragma GCC diagnostic push
@@ -1192,6 +1471,18 @@ void ImageViewer::saveImage() {
     }
 
     setFeedback(tr("Saving..."));
+    if (Settings::colorsActive) {
+        refresh(); // only the preview is colourized so far
+    }
+
+    QString savePath = fullImagePath;
+    if (!Settings::saveDirectory.isEmpty()) {
+        QDir saveDir(Settings::saveDirectory);
+        savePath = saveDir.filePath(QFileInfo(fullImagePath).fileName());
+    }
+    if (saveOrientation(savePath)) {
+        return;
+    }
 
     try {
         image = Exiv2::ImageFactory::open(fullImagePath.toStdString());
@@ -1203,11 +1494,6 @@ void ImageViewer::saveImage() {
     }
 
     QImageReader imageReader(fullImagePath);
-    QString savePath = fullImagePath;
-    if (!Settings::saveDirectory.isEmpty()) {
-        QDir saveDir(Settings::saveDirectory);
-        savePath = saveDir.filePath(QFileInfo(fullImagePath).fileName());
-    }
     if (!viewerImage.save(savePath, imageReader.format().toUpper(), Settings::defaultSaveQuality)) {
         MessageBox msgBox(this);
         msgBox.critical(tr("Error"), tr("Failed to save image."));
@@ -1268,6 +1554,9 @@ void ImageViewer::saveImageAs() {
     bool exifError = false;
 
     setCursorHiding(false);
+    if (Settings::colorsActive) {
+        refresh(); // only the preview is colourized so far
+    }
 
     QString fileName = QFileDialog::getSaveFileName(this,
                                                     tr("Save image as"),
@@ -1330,6 +1619,9 @@ bool ImageViewer::isNewImage() {
 }
 
 void ImageViewer::copyImage() {
+    if (Settings::colorsActive) {
+        refresh(); // only the preview is colourized so far
+    }
     QApplication::clipboard()->setImage(viewerImage);
 }
 
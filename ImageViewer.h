@@ -20,8 +20,10 @@
 #define IMAGE_VIEWER_H
 
 class CropRubberBand;
+class ImagePreloader;
 class ImageWidget;
 class QMovie;
+#include <QDateTime>
 #include <QLabel>
 #include <QPointer>
 #include <QScrollArea>
@@ -33,6 +35,7 @@ Q_OBJECT
 
 public:
     ImageViewer(QWidget *parent);
+    ~ImageViewer();
     bool tempDisableResize;
     bool batchMode = false;
     QString fullImagePath;
@@ -54,12 +57,16 @@ public:
     };
 
     void clearImage();
+    void interact();
     void configureLetterbox();
     QSize currentImageSize() const;
     bool isNewImage();
     QRect lastCropGeometry() const { return m_isoCropRect; }
+    // the last crop and rotation, for images of referenceSize
+    bool batchEdit(QTransform *edit, QSize *size, QSize *referenceSize) const;
     void loadImage(QString imageFileName, const QImage &preview = QImage());
-    void preload(QString imageFileName);
+    void preload(const QStringList &imageFileNames);
+    void previewColors();
     void refresh();
     void resizeImage(QPoint focus = QPoint(-1, -1));
     void scaleImage(QSize newSize);
@@ -112,8 +119,16 @@ private:
     QImage origImage;
     QImage viewerImage;
     QImage mirrorImage;
-    QImage m_preloadedImage;
-    QString m_preloadedPath;
+    // what the geometric edits of origImage started from
+    QImage m_editSource;
+    QTransform m_editTransform;
+    qint64 m_editResultKey = 0;
+    QImage m_colorProxy;
+    qint64 m_colorProxySource = 0;
+    ImagePreloader *m_preloader;
+    // to tell whether origImage is still what was decoded from the file
+    qint64 m_decodedImageKey = 0;
+    QDateTime m_decodedLastModified;
     bool m_crossfade;
     QTimer *mouseMovementTimer;
     QPointer<QMovie> animation;
@@ -133,6 +148,9 @@ private:
     QRect m_letterbox;
     CropRubberBand *cropRubberBand;
     QRect m_isoCropRect;
+    QRect m_batchCropRect;
+    bool m_batchCropRotating = false;
+    QSize m_batchReferenceSize;
 
     void setMouseMoveData(bool lockMove, int lMouseX, int lMouseY);
 
@@ -140,8 +158,14 @@ private:
 
     void mirror();
 
+    void applyEdit(const QTransform &edit, const QSize &size);
+    QRect cropGeometry(bool *rotating);
     void colorize();
+    QByteArray derivation() const;
+    QTransform viewTransformation() const;
+    bool saveOrientation(const QString &savePath);
     void setImage(const QImage &image);
+    void showPreview(const QImage &preview);
 };
 
 #endif // IMAGE_VIEWER_H
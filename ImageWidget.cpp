@@ -16,6 +16,7 @@
  *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "ImageTiles.h"
 #include "ImageWidget.h"
 #include <QDebug>
 #include <QPainter>
@@ -27,6 +28,18 @@ ImageWidget::ImageWidget(QWidget *parent) : QOpenGLWidget(parent)
     m_fadeout = 0.0;
     m_crossfade = false;
     setAutoFillBackground(true);
+    m_interactionTimer.setSingleShot(true);
+    m_interactionTimer.setInterval(150);
+    connect(&m_interactionTimer, &QTimer::timeout, this, [=]() {
+        m_interacting = false;
+        update();
+    });
+}
+
+ImageWidget::~ImageWidget()
+{
+    if (m_tiles)
+        m_tiles->dispose();
 }
 
 bool ImageWidget::empty()
@@ -34,6 +47,12 @@ bool ImageWidget::empty()
     return m_image.isNull();
 }
 
+void ImageWidget::interact()
+{
+    m_interacting = true;
+    m_interactionTimer.start();
+}
+
 const QImage &ImageWidget::image()
 {
     return m_image;
@@ -42,19 +61,26 @@ const QImage &ImageWidget::image()
 void ImageWidget::setCrossfade(bool yesno)
 {
     m_crossfade = yesno;
-    if (!m_crossfade)
+    if (!m_crossfade) {
         m_prevImage = QImage();
+        m_prevBuffer = RenderBuffer();
+    }
 }
 
-void ImageWidget::setImage(const QImage &i, QTransform matrix)
+void ImageWidget::setImage(const QImage &i, QTransform matrix, const QSize &sourceSize)
 {
     if (m_crossfade) {
         m_prevImage = m_image;
         m_prevImagePos = m_imagePos;
         m_prevImageSize = m_imageSize;
+        m_prevBuffer = m_buffer;
     }
+    m_buffer = RenderBuffer();
+    if (m_tiles)
+        m_tiles->dispose();
     m_image = i;
     m_imageSize = i.size();
+    m_sourceSize = sourceSize.isValid() ? sourceSize : i.size();
     m_rotation = 0;
     m_exifTransformation = matrix;
     if (m_crossfade) {
@@ -66,7 +92,7 @@ void ImageWidget::setImage(const QImage &i, QTransform matrix)
             fadeAnimator->setEndValue(0.0);
             fadeAnimator->setDuration(250);
             connect(fadeAnimator, &QVariantAnimation::valueChanged, [=](const QVariant &value) {m_fadeout = value.toFloat(); update();});
-            connect(fadeAnimator, &QVariantAnimation::finished, [=]() {m_prevImage = QImage();});
+            connect(fadeAnimator, &QVariantAnimation::finished, [=]() {m_prevImage = QImage(); m_prevBuffer = RenderBuffer();});
             connect(fadeAnimator, &QObject::destroyed, [=]() {fadeAnimator = nullptr;});
         }
         fadeAnimator->start();
@@ -81,6 +107,18 @@ void ImageWidget::setRotation(qreal r)
     update();
 }
 
+void ImageWidget::setTiles(ImageTiles *tiles)
+{
+    if (m_tiles)
+        m_tiles->dispose();
+    m_tiles = tiles;
+    if (m_tiles) {
+        m_tiles->setParent(this);
+        connect(m_tiles, &ImageTiles::tileReady, this, [=]() { update(); });
+    }
+    update();
+}
+
 QTransform ImageWidget::transformation() const {
     return transformation(m_image, m_imageSize, m_imagePos);
 }
@@ -143,7 +181,7 @@ void ImageWidget::paintEvent(QPaintEvent *ev)
         return;
 
     QPainter painter(this);
-    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, !m_interacting);
     QRect clip = rect();
     clip.adjust(qRound(width()*m_letterBox.x()/100.0),
                 qRound(height()*m_letterBox.y()/100.0),
@@ -156,10 +194,15 @@ void ImageWidget::paintEvent(QPaintEvent *ev)
     // I don't want to copy the Image into a pre-translation, but for now that's what we'll do
 //    painter.setWorldTransform(m_exifTransformation);
 
-    painter.setTransform(transformation());
+    const QImage &image = renderBuffer(m_image, m_imageSize, m_buffer);
+    painter.setTransform(transformation(image, m_imageSize, m_imagePos));
     if (m_crossfade)
         painter.setOpacity(1.0 - m_fadeout);
-    painter.drawImage(0,0, m_image);
+    painter.drawImage(0,0, image);
+    if (m_tiles) {
+        painter.setTransform(transformation());
+        paintTiles(painter, clip);
+    }
 
     if (m_crossfade) {
         if (m_prevImage.size().isNull())
@@ -168,8 +211,67 @@ void ImageWidget::paintEvent(QPaintEvent *ev)
         scale = qMax(float(m_imageSize.width()) / m_prevImage.width(), float(m_imageSize.height()) / m_prevImage.height());
         if (scale == 0.0f)
             return;
-        painter.setTransform(transformation(m_prevImage, m_prevImageSize, m_prevImagePos));
+        const QImage &prevImage = renderBuffer(m_prevImage, m_prevImageSize, m_prevBuffer);
+        painter.setTransform(transformation(prevImage, m_prevImageSize, m_prevImagePos));
         painter.setOpacity(m_fadeout);
-        painter.drawImage(0,0, m_prevImage);
+        painter.drawImage(0,0, prevImage);
+    }
+}
+
+const QImage &ImageWidget::renderBuffer(const QImage &image, const QSize &size, RenderBuffer &buffer)
+{
+    // Resampling a large image on every repaint makes panning and fading crawl, so downscaled images
+    // are scaled once per size and then merely blitted. Magnified ones only resample the visible part anyway.
+    const qreal dpr = devicePixelRatioF();
+    const QSize deviceSize(qRound(size.width() * dpr), qRound(size.height() * dpr));
+    if (deviceSize.isEmpty() || deviceSize.width() >= image.width() || deviceSize.height() >= image.height())
+        return image;
+    // while zooming or rotating any fit is better than rescaling on every step
+    if (m_interacting)
+        return buffer.sourceKey == image.cacheKey() ? buffer.image : image;
+    if (buffer.sourceKey != image.cacheKey() || buffer.image.size() != deviceSize) {
+        buffer.sourceKey = image.cacheKey();
+        buffer.image = image.scaled(deviceSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+    return buffer.image;
+}
+
+void ImageWidget::paintTiles(QPainter &painter, const QRect &clip)
+{
+    // device pixels per overview pixel, the overview suffices as long as it isn't magnified
+    const qreal scale = qMax(qreal(m_imageSize.width()) / m_image.width(),
+                             qreal(m_imageSize.height()) / m_image.height()) * devicePixelRatioF();
+    m_tiles->beginFrame();
+    if (scale <= 1.0)
+        return;
+
+    bool invertible;
+    const QTransform inverted = painter.transform().inverted(&invertible);
+    if (!invertible)
+        return;
+    const qreal overviewToFull = qreal(m_tiles->imageSize().width()) / m_image.width();
+    const QRectF visible = inverted.mapRect(QRectF(clip)).intersected(QRectF(m_image.rect()));
+    const QRect fullVisible = QRectF(visible.topLeft() * overviewToFull,
+                                     visible.size() * overviewToFull).toAlignedRect()
+                                .intersected(QRect(QPoint(0, 0), m_tiles->imageSize()));
+    if (fullVisible.isEmpty())
+        return;
+
+    // pick the coarsest level that is still not magnified
+    const qreal fullScale = scale / overviewToFull;
+    int level = 0;
+    while (fullScale * (2 << level) <= 1.0)
+        ++level;
+
+    const int span = ImageTiles::TileSize << level;
+    for (int row = fullVisible.top() / span; row <= fullVisible.bottom() / span; ++row) {
+        for (int column = fullVisible.left() / span; column <= fullVisible.right() / span; ++column) {
+            const QImage tile = m_tiles->tile(level, column, row);
+            if (tile.isNull())
+                continue;
+            const QRectF target(column * span / overviewToFull, row * span / overviewToFull,
+                                (tile.width() << level) / overviewToFull, (tile.height() << level) / overviewToFull);
+            painter.drawImage(target, tile);
+        }
     }
 }
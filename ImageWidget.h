@@ -20,25 +20,36 @@
 #define IMAGEWIDGET_H
 
 #include <QOpenGLWidget>
+#include <QPointer>
+#include <QTimer>
 #include <QTransform>
 
+class ImageTiles;
+
 class ImageWidget : public QOpenGLWidget
 {
     Q_OBJECT
 public:
     explicit ImageWidget(QWidget *parent = nullptr);
+    ~ImageWidget();
     bool empty();
+    // render quickly until input was idle for a moment
+    void interact();
     void setFlip(Qt::Orientations o);
     const QImage &image();
     const QPoint &imagePosition() const { return m_imagePos; }
     const QSize &imageSize() const { return m_imageSize; }
     void setCrossfade(bool yesno);
-    void setImage(const QImage &i, QTransform matrix);
+    // sourceSize is the size of the image i stands in for, if it's a scaled down proxy
+    void setImage(const QImage &i, QTransform matrix, const QSize &sourceSize = QSize());
+    const QSize &sourceSize() const { return m_sourceSize; }
     void setImagePosition(const QPoint &p);
     void setImageSize(const QSize &s);
     void setLetterbox(const QRect &letterbox);
     qreal rotation() const { return m_rotation; }
     void setRotation(qreal r);
+    // full resolution detail for an image that was only set as a downscaled overview, takes ownership
+    void setTiles(ImageTiles *tiles);
     QTransform transformation() const;
 
 protected:
@@ -48,9 +59,16 @@ protected:
     void paintEvent(QPaintEvent *event) override;
 
 private:
+    struct RenderBuffer {
+        qint64 sourceKey = 0;
+        QImage image;
+    };
     QTransform transformation(const QImage &img, const QSize &sz, const QPoint &pos) const;
+    const QImage &renderBuffer(const QImage &image, const QSize &size, RenderBuffer &buffer);
+    void paintTiles(QPainter &painter, const QRect &clip);
     QImage m_image;
     QImage m_prevImage;
+    QSize m_sourceSize;
     qreal m_rotation = 0;
     QSize m_imageSize;
     QPoint m_imagePos;
@@ -61,6 +79,11 @@ private:
     QRect m_letterBox;
     float m_fadeout;
     bool m_crossfade;
+    QPointer<ImageTiles> m_tiles;
+    RenderBuffer m_buffer;
+    RenderBuffer m_prevBuffer;
+    bool m_interacting = false;
+    QTimer m_interactionTimer;
 };
 
 #endif // IMAGEWIDGET_H
@@ -16,8 +16,10 @@
  *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <QFileInfo>
 #include <QImage>
 #include <QMap>
+#include <QMutex>
 #include <QSet>
 #include <exiv2/exiv2.hpp>
 #include "Settings.h"
@@ -29,12 +31,17 @@ class ImageMetadata {
 public:
     QSet<QString> tags;
     long orientation;
+    // whether cache() has added the tags to Settings::knownTags, prefetch() doesn't
+    bool tagsKnown = false;
 };
 
 static QMap<QString, ImageMetadata> gs_cache;
+// prefetch() fills the cache from worker threads, so every access goes through this
+static QMutex gs_mutex;
 
 // updateImageTags
 bool updateTags(const QString &imageFileName, QSet<QString> tags) {
+    QMutexLocker locker(&gs_mutex);
     QMap<QString, ImageMetadata>::iterator it = gs_cache.find(imageFileName);
     if (it == gs_cache.end())
         return false;
@@ -44,6 +51,7 @@ bool updateTags(const QString &imageFileName, QSet<QString> tags) {
 
 // removeTagFromImage
 bool removeTag(const QString &imageFileName, const QString &tagName) {
+    QMutexLocker locker(&gs_mutex);
     QMap<QString, ImageMetadata>::iterator it = gs_cache.find(imageFileName);
     if (it == gs_cache.end())
         return false;
@@ -52,24 +60,25 @@ bool removeTag(const QString &imageFileName, const QString &tagName) {
 
 // removeImage
 void forget(const QString &imageFileName) {
+    QMutexLocker locker(&gs_mutex);
     gs_cache.remove(imageFileName);
 }
 
 // getImageTags
-const QSet<QString> &tags(const QString &imageFileName) {
-    static QSet<QString> dummy;
-    QMap<QString, ImageMetadata>::iterator it = gs_cache.find(imageFileName);
-    if (it == gs_cache.end())
-        return dummy;
+QSet<QString> tags(const QString &imageFileName) {
+    QMutexLocker locker(&gs_mutex);
+    QMap<QString, ImageMetadata>::const_iterator it = gs_cache.constFind(imageFileName);
+    if (it == gs_cache.constEnd())
+        return QSet<QString>();
     return it->tags;
 }
 
 // getImageOrientation
 long orientation(const QString &imageFileName) {
+    // worker threads ask for this too
+    prefetch(imageFileName);
+    QMutexLocker locker(&gs_mutex);
     QMap<QString, ImageMetadata>::iterator it = gs_cache.find(imageFileName);
-    if (it == gs_cache.end())
-        cache(imageFileName);
-    it = gs_cache.find(imageFileName);
     if (it == gs_cache.end())
         return 0;
     return it->orientation;
@@ -77,11 +86,13 @@ long orientation(const QString &imageFileName) {
 
 // setImageTags
 void setTags(const QString &imageFileName, QSet<QString> tags) {
+    QMutexLocker locker(&gs_mutex);
     gs_cache[imageFileName].tags = tags;
 }
 
 // addTagToImage
 bool addTag(const QString &imageFileName, const QString &tagName) {
+    QMutexLocker locker(&gs_mutex);
     QMap<QString, ImageMetadata>::iterator it = gs_cache.find(imageFileName);
     if (it == gs_cache.end())
         return false; // no such image
@@ -94,12 +105,13 @@ bool addTag(const QString &imageFileName, const QString &tagName) {
 
 // clear
 void dropCache() {
+    QMutexLocker locker(&gs_mutex);
     gs_cache.clear();
 }
 
-QTransform transformation(const QString &imageFullPath) {
+static QTransform orientationTransformation(long orientation) {
     QTransform trans;
-    switch (orientation(imageFullPath)) {
+    switch (orientation) {
         case 1:
             break;
         case 2:
@@ -142,10 +154,57 @@ QTransform transformation(const QString &imageFullPath) {
     return trans;
 }
 
-// loadImageMetadata
-void cache(const QString &imageFullPath) {
-    if (gs_cache.contains(imageFullPath))
-        return;
+QTransform transformation(const QString &imageFullPath) {
+    return orientationTransformation(orientation(imageFullPath));
+}
+
+QString sidecarPath(const QString &imageFullPath) {
+    // darktable and digiKam append to the file name, Adobe replaces the suffix
+    const QString appended = imageFullPath + QLatin1String(".xmp");
+    if (QFileInfo::exists(appended)) {
+        return appended;
+    }
+    // Adobe only writes sidecars for raw files and embeds XMP in the others, which
+    // keeps IMG_1.JPG from taking the sidecar of IMG_1.CR2 next to it
+    static const QStringList embedding = { "jpg", "jpeg", "jpe", "tif", "tiff", "png", "webp",
+                                           "gif", "psd", "dng", "heic", "heif", "avif", "jxl" };
+    const QFileInfo imageInfo(imageFullPath);
+    if (embedding.contains(imageInfo.suffix().toLower())) {
+        return appended;
+    }
+    const QString replaced = imageInfo.path() + QLatin1Char('/') + imageInfo.completeBaseName() + QLatin1String(".xmp");
+    if (QFileInfo::exists(replaced)) {
+        return replaced;
+    }
+    return appended;
+}
+
+long orientation(const QTransform &transform) {
+    for (long orientation = 1; orientation <= 8; ++orientation) {
+        const QTransform trans = orientationTransformation(orientation);
+        if (qRound(trans.m11()) == qRound(transform.m11()) && qRound(trans.m12()) == qRound(transform.m12()) &&
+            qRound(trans.m21()) == qRound(transform.m21()) && qRound(trans.m22()) == qRound(transform.m22())) {
+            return orientation;
+        }
+    }
+    return 0;
+}
+
+static bool isCached(const QString &imageFullPath) {
+    QMutexLocker locker(&gs_mutex);
+    return gs_cache.contains(imageFullPath);
+}
+
+static void insert(const QString &imageFullPath, const ImageMetadata &imageMetadata) {
+    QMutexLocker locker(&gs_mutex);
+    gs_cache.insert(imageFullPath, imageMetadata);
+}
+
+static ImageMetadata readImage(const QString &imageFullPath) {
+    // the XMP toolkit initializes lazily and not threadsafe, do that once before any reader runs
+    static const bool xmpInitialized = Exiv2::XmpParser::initialize();
+    Q_UNUSED(xmpInitialized);
+
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated-declarations"
 #if EXIV2_TEST_VERSION(0,28,0)
@@ -163,13 +222,11 @@ void cache(const QString &imageFullPath) {
         exifImage->readMetadata();
     } catch (Exiv2::Error &error) {
         qWarning() << "Error loading image for reading metadata" << error.what();
-        gs_cache.insert(imageFullPath, imageMetadata);
-        return;
+        return imageMetadata;
     }
 
     if (!exifImage->good()) {
-        gs_cache.insert(imageFullPath, imageMetadata);
-        return;
+        return imageMetadata;
     }
 
     if (exifImage->supportsMetadata(Exiv2::mdExif)) try {
@@ -200,14 +257,84 @@ void cache(const QString &imageFullPath) {
 
                 QString tagName = QString::fromUtf8(iptcIt->toString().c_str());
                 imageMetadata.tags.insert(tagName);
-                Settings::knownTags.insert(tagName);
             }
         }
     } catch (Exiv2::Error &error) {
         qWarning() << "Failed to read Iptc metadata";
     }
 
-    gs_cache.insert(imageFullPath, imageMetadata);
+    return imageMetadata;
+}
+
+// Keywords from an XMP sidecar, false if it can't be read or has no keywords entry at all
+static bool readSidecarTags(const QString &sidecarPath, QSet<QString> *tags) {
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#if EXIV2_TEST_VERSION(0,28,0)
+    Exiv2::Image::UniquePtr sidecar;
+#else
+    Exiv2::Image::AutoPtr sidecar;
+#endif
+#pragma clang diagnostic pop
+
+    try {
+        sidecar = Exiv2::ImageFactory::open(sidecarPath.toStdString());
+        sidecar->readMetadata();
+        Exiv2::XmpData::const_iterator it = sidecar->xmpData().findKey(Exiv2::XmpKey("Xmp.dc.subject"));
+        if (it == sidecar->xmpData().end()) {
+            return false;
+        }
+        for (int i = 0; i < int(it->count()); ++i) {
+            tags->insert(QString::fromUtf8(it->toString(i).c_str()));
+        }
+    } catch (Exiv2::Error &error) {
+        qWarning() << "Failed to read XMP sidecar" << sidecarPath << error.what();
+        return false;
+    }
+    return true;
+}
+
+static ImageMetadata read(const QString &imageFullPath) {
+    ImageMetadata imageMetadata = readImage(imageFullPath);
+    // the tags of a sidecar replace those in the image, the image may not even be writable,
+    // but a sidecar without keywords, like one that only holds raw development, leaves them alone
+    const QString sidecar = sidecarPath(imageFullPath);
+    QSet<QString> sidecarTags;
+    if (QFileInfo::exists(sidecar) && readSidecarTags(sidecar, &sidecarTags)) {
+        imageMetadata.tags = sidecarTags;
+    }
+    return imageMetadata;
+}
+
+// loadImageMetadata
+void cache(const QString &imageFullPath) {
+    QSet<QString> tags;
+    gs_mutex.lock();
+    QMap<QString, ImageMetadata>::iterator it = gs_cache.find(imageFullPath);
+    const bool cached = it != gs_cache.end();
+    if (cached) {
+        if (it->tagsKnown) {
+            gs_mutex.unlock();
+            return;
+        }
+        it->tagsKnown = true;
+        tags = it->tags;
+    }
+    gs_mutex.unlock();
+
+    if (!cached) {
+        ImageMetadata imageMetadata = read(imageFullPath);
+        imageMetadata.tagsKnown = true;
+        tags = imageMetadata.tags;
+        insert(imageFullPath, imageMetadata);
+    }
+    Settings::knownTags.unite(tags);
+}
+
+void prefetch(const QString &imageFullPath) {
+    if (isCached(imageFullPath))
+        return;
+    insert(imageFullPath, read(imageFullPath));
 }
 
 } // namespace Metadata
\ No newline at end of file
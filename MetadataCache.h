@@ -23,14 +23,21 @@
 
 namespace Metadata {
     bool addTag(const QString &imageFileName, const QString &tagName);
+    // GUI thread only, also adds the tags to Settings::knownTags
     void cache(const QString &imageFullPath);
     void dropCache();
     QTransform transformation(const QString &imageFullPath);
     void forget(const QString &imageFileName);
     long orientation(const QString &imageFileName);
+    // the Exif orientation that transforms an image like transform does, translation aside, 0 if there's none
+    long orientation(const QTransform &transform);
+    // threadsafe variant of cache() that leaves Settings::knownTags alone
+    void prefetch(const QString &imageFullPath);
     bool removeTag(const QString &imageFileName, const QString &tagName);
+    // the XMP sidecar of an image, or where a new one goes
+    QString sidecarPath(const QString &imageFullPath);
     void setTags(const QString &imageFileName, QSet<QString> tags);
-    const QSet<QString> &tags(const QString &imageFileName);
+    QSet<QString> tags(const QString &imageFileName);
     bool updateTags(const QString &imageFileName, QSet<QString> tags);
 };
 
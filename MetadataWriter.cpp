@@ -0,0 +1,350 @@
+/*
+ *  Copyright (C) 2013-2018 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QThread>
+#include <exiv2/exiv2.hpp>
+#include <functional>
+#include "MetadataCache.h"
+#include "MetadataWriter.h"
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// how long an edit waits for more edits of the same file
+static const int gs_coalesceDelay = 300;
+
+MetadataWriter *MetadataWriter::instance() {
+    static MetadataWriter *s_instance = new MetadataWriter(QCoreApplication::instance());
+    return s_instance;
+}
+
+MetadataWriter::MetadataWriter(QObject *parent) : QObject(parent) {
+    // the XMP toolkit must not initialize lazily from several threads at once
+    Exiv2::XmpParser::initialize();
+
+    // the disk is the bottleneck, a few writers are enough to hide the latency of each
+    const int workers = qBound(1, QThread::idealThreadCount(), 4);
+    for (int i = 0; i < workers; ++i) {
+        QThread *worker = QThread::create([=]() { work(); });
+        worker->start(QThread::LowPriority);
+        m_workers << worker;
+    }
+}
+
+MetadataWriter::~MetadataWriter() {
+    // nothing that was queued gets lost
+    m_mutex.lock();
+    m_quit = true;
+    m_wake.wakeAll();
+    m_mutex.unlock();
+    for (QThread *worker : m_workers) {
+        worker->wait();
+        delete worker;
+    }
+}
+
+void MetadataWriter::setTags(const QString &imagePath, const QSet<QString> &tags, bool sidecar) {
+    Edit edit;
+    edit.setTags = true;
+    edit.tags = tags;
+    edit.sidecar = sidecar;
+    enqueue(imagePath, edit);
+}
+
+void MetadataWriter::clearMetadata(const QString &imagePath) {
+    Edit edit;
+    edit.clear = true;
+    enqueue(imagePath, edit);
+}
+
+void MetadataWriter::setOrientation(const QString &imagePath, long orientation) {
+    Edit edit;
+    edit.orientation = orientation;
+    enqueue(imagePath, edit);
+}
+
+void MetadataWriter::enqueue(const QString &imagePath, const Edit &edit) {
+    QMutexLocker locker(&m_mutex);
+    QHash<QString, Pending>::iterator it = m_pending.find(imagePath);
+    if (it == m_pending.end()) {
+        it = m_pending.insert(imagePath, Pending());
+        m_queue << imagePath;
+    }
+
+    Edit &merged = it->edit;
+    if (edit.clear) {
+        // whatever came before is gone with the metadata
+        merged = Edit();
+        merged.clear = true;
+    }
+    if (edit.setTags) {
+        merged.setTags = true;
+        merged.tags = edit.tags;
+        merged.sidecar = edit.sidecar;
+    }
+    if (edit.orientation) {
+        merged.orientation = edit.orientation;
+    }
+    it->due = QDeadlineTimer(gs_coalesceDelay);
+    m_wake.wakeOne();
+}
+
+void MetadataWriter::flush(const QString &imagePath) {
+    QMutexLocker locker(&m_mutex);
+    ++m_flushing;
+    m_wake.wakeAll();
+    while (imagePath.isEmpty() ? !(m_pending.isEmpty() && m_writing.isEmpty())
+                               : (m_pending.contains(imagePath) || m_writing.contains(imagePath))) {
+        m_written.wait(&m_mutex);
+    }
+    --m_flushing;
+}
+
+void MetadataWriter::work() {
+    QMutexLocker locker(&m_mutex);
+    forever {
+        // the oldest file that is due and isn't being written already, edits of one file must not overtake each other
+        QString imagePath;
+        QDeadlineTimer wakeUp(QDeadlineTimer::Forever);
+        for (const QString &path : std::as_const(m_queue)) {
+            if (m_writing.contains(path)) {
+                continue;
+            }
+            const QDeadlineTimer due = m_pending.value(path).due;
+            if (m_flushing || m_quit || due.hasExpired()) {
+                imagePath = path;
+            } else {
+                wakeUp = due;
+            }
+            break;
+        }
+        if (imagePath.isEmpty()) {
+            if (m_quit && m_pending.isEmpty()) {
+                return;
+            }
+            m_wake.wait(&m_mutex, wakeUp);
+            continue;
+        }
+
+        m_queue.removeOne(imagePath);
+        const Edit edit = m_pending.take(imagePath).edit;
+        m_writing.insert(imagePath);
+        locker.unlock();
+
+        QString error;
+        const bool ok = apply(imagePath, edit, &error);
+
+        locker.relock();
+        m_writing.remove(imagePath);
+        // the cache already holds edited tags, anything else is read again from the file,
+        // unless a newer edit is about to change it once more
+        if (!ok || ((edit.clear || edit.orientation) && !m_pending.contains(imagePath))) {
+            Metadata::forget(imagePath);
+        }
+        const bool drained = m_pending.isEmpty() && m_writing.isEmpty();
+        m_written.wakeAll();
+        // the next edit of this file may wait for it
+        m_wake.wakeAll();
+        locker.unlock();
+
+        if (!ok) {
+            qWarning() << "Failed to write metadata to" << imagePath << error;
+            emit failed(imagePath, error);
+        }
+        if (drained) {
+            emit idle();
+        }
+        locker.relock();
+    }
+}
+
+// Replacing a file breaks its hard links and makes it ours, and it can't be done in a directory
+// we may not create files in. Those files are overwritten in place instead.
+static bool mustWriteInPlace(const QString &path) {
+#ifdef Q_OS_UNIX
+    struct stat info;
+    if (stat(QFile::encodeName(path).constData(), &info) == 0 && (info.st_nlink > 1 || info.st_uid != geteuid())) {
+        return true;
+    }
+#endif
+    return !QFileInfo(QFileInfo(path).path()).isWritable();
+}
+
+// Runs change on the metadata of path in memory, the result replaces the file only once it's complete.
+// Where mustWriteInPlace() it overwrites the file instead, which keeps hard links and the owner,
+// but a crash or a full disk during that write leaves the file damaged. Replacing the file drops extended attributes.
+// A missing file gets created as an XMP sidecar if create is set.
+static bool rewrite(const QString &path, bool create, const std::function<void(Exiv2::Image &)> &change,
+                    QString *error) {
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#if EXIV2_TEST_VERSION(0,28,0)
+    Exiv2::Image::UniquePtr image;
+#else
+    Exiv2::Image::AutoPtr image;
+#endif
+#pragma clang diagnostic pop
+
+    const bool exists = QFileInfo::exists(path);
+    const bool inPlace = exists && mustWriteInPlace(path);
+    QFile file(path);
+    // the private mapping is the only copy of the original, Exiv2 may patch it when the layout stays the same
+    uchar *original = nullptr;
+    if (exists || !create) {
+        // a read-only file stays as it is, even where it could be replaced
+        if (!file.open(QIODevice::ReadWrite)) {
+            *error = file.errorString();
+            return false;
+        }
+        original = file.map(0, file.size(), QFileDevice::MapPrivateOption);
+        if (!original) {
+            *error = file.errorString();
+            return false;
+        }
+    }
+
+    try {
+        if (original) {
+            image = Exiv2::ImageFactory::open(original, file.size());
+            image->readMetadata();
+        } else {
+            image = Exiv2::ImageFactory::create(Exiv2::ImageType::xmp);
+        }
+
+        change(*image);
+
+        // only the metadata segments get rewritten, the compressed image data is copied as it is
+        image->writeMetadata();
+    } catch (Exiv2::Error &exiv2Error) {
+        *error = QString::fromUtf8(exiv2Error.what());
+        return false;
+    }
+
+    Exiv2::BasicIo &io = image->io();
+    const qint64 size = qint64(io.size());
+    const char *data = reinterpret_cast<const char *>(io.mmap());
+    if (!inPlace) {
+        QSaveFile saveFile(path);
+        const bool written = saveFile.open(QIODevice::WriteOnly) && saveFile.write(data, size) == size;
+        // the original must not be held open when it gets replaced, Windows refuses that
+        image.reset();
+        if (original) {
+            file.unmap(original);
+        }
+        file.close();
+        if (!written || !saveFile.commit()) {
+            *error = saveFile.errorString();
+            return false;
+        }
+        return true;
+    }
+
+    const bool written = file.write(data, size) == size;
+    image.reset();
+    file.unmap(original);
+    if (!written || (file.size() != size && !file.resize(size))) {
+        *error = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool MetadataWriter::apply(const QString &imagePath, const Edit &edit, QString *error) {
+    const QString sidecarPath = Metadata::sidecarPath(imagePath);
+    const bool hasSidecar = QFileInfo::exists(sidecarPath);
+
+    const bool tagsToImage = edit.setTags && !edit.sidecar;
+    if (edit.clear || edit.orientation || tagsToImage) {
+        const bool ok = rewrite(imagePath, false, [&](Exiv2::Image &image) {
+            if (edit.clear) {
+                image.clearMetadata();
+            }
+
+            if (tagsToImage) {
+                Exiv2::IptcData newIptcData;
+
+                /* copy existing data */
+                Exiv2::IptcData &iptcData = image.iptcData();
+                Exiv2::IptcData::iterator end = iptcData.end();
+                for (Exiv2::IptcData::iterator iptcIt = iptcData.begin(); iptcIt != end; ++iptcIt) {
+                    if (iptcIt->tagName() != "Keywords") {
+                        newIptcData.add(*iptcIt);
+                    }
+                }
+
+                /* add new tags */
+                for (const QString &tag : edit.tags) {
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#if EXIV2_TEST_VERSION(0,28,0)
+                    Exiv2::Value::UniquePtr value = Exiv2::Value::create(Exiv2::string);
+#else
+                    Exiv2::Value::AutoPtr value = Exiv2::Value::create(Exiv2::string);
+#endif
+#pragma clang diagnostic pop
+
+                    value->read(tag.toStdString());
+                    Exiv2::IptcKey key("Iptc.Application2.Keywords");
+                    newIptcData.add(key, value.get());
+                }
+
+                image.setIptcData(newIptcData);
+            }
+
+            if (edit.orientation) {
+                image.exifData()["Exif.Image.Orientation"] = static_cast<uint16_t>(edit.orientation);
+                Exiv2::XmpData::iterator it = image.xmpData().findKey(Exiv2::XmpKey("Xmp.tiff.Orientation"));
+                if (it != image.xmpData().end()) {
+                    it->setValue(std::to_string(edit.orientation));
+                }
+            }
+        }, error);
+        if (!ok) {
+            return false;
+        }
+    }
+
+    // the keywords of an existing sidecar take precedence when reading, so they must not fall behind the image.
+    // Clearing only drops them, the rest of a sidecar belongs to other programs.
+    const bool tagsToSidecar = edit.setTags && (edit.sidecar || hasSidecar);
+    if (tagsToSidecar || (edit.clear && hasSidecar)) {
+        return rewrite(sidecarPath, true, [&](Exiv2::Image &sidecar) {
+            Exiv2::XmpData &xmpData = sidecar.xmpData();
+            Exiv2::XmpData::iterator it = xmpData.findKey(Exiv2::XmpKey("Xmp.dc.subject"));
+            if (it != xmpData.end()) {
+                xmpData.erase(it);
+            }
+            if (tagsToSidecar) {
+                // an empty bag still says the image has no tags, rather than those in the image
+                Exiv2::XmpArrayValue value(Exiv2::xmpBag);
+                for (const QString &tag : edit.tags) {
+                    value.read(tag.toStdString());
+                }
+                xmpData.add(Exiv2::XmpKey("Xmp.dc.subject"), &value);
+            }
+        }, error);
+    }
+    return true;
+}
@@ -0,0 +1,91 @@
+/*
+ *  Copyright (C) 2013-2018 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef METADATA_WRITER_H
+#define METADATA_WRITER_H
+
+class QThread;
+#include <QDeadlineTimer>
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+#include <QWaitCondition>
+
+// Queues metadata edits and writes them on a pool of worker threads.
+// Edits of a file that is still waiting are merged, so it gets written once with its final state,
+// and every write goes to a temporary file that replaces the image only once it's complete,
+// unless the image has hard links or another owner or can't be replaced, then it's overwritten in place.
+class MetadataWriter : public QObject {
+Q_OBJECT
+
+public:
+    struct Edit {
+        // drop all metadata before the rest applies
+        bool clear = false;
+        bool setTags = false;
+        QSet<QString> tags;
+        // the tags go to the XMP sidecar and leave the image alone
+        bool sidecar = false;
+        // Exif orientation, left alone if 0
+        long orientation = 0;
+    };
+
+    static MetadataWriter *instance();
+    ~MetadataWriter();
+
+    // the keywords the image ends up with
+    void setTags(const QString &imagePath, const QSet<QString> &tags, bool sidecar = false);
+    void clearMetadata(const QString &imagePath);
+    void setOrientation(const QString &imagePath, long orientation);
+    // blocks until the edits of imagePath, or all edits if it's empty, are on disk
+    void flush(const QString &imagePath = QString());
+
+    // writes edit right away on the calling thread
+    static bool apply(const QString &imagePath, const Edit &edit, QString *error);
+
+signals:
+    void failed(const QString &imagePath, const QString &error);
+    // everything queued is written
+    void idle();
+
+private:
+    struct Pending {
+        Edit edit;
+        // edits that come in quick succession get merged before this
+        QDeadlineTimer due;
+    };
+
+    explicit MetadataWriter(QObject *parent);
+    void enqueue(const QString &imagePath, const Edit &edit);
+    void work();
+
+    QMutex m_mutex;
+    QWaitCondition m_wake;
+    QWaitCondition m_written;
+    QHash<QString, Pending> m_pending;
+    // the pending files in the order they came in
+    QStringList m_queue;
+    QSet<QString> m_writing;
+    int m_flushing = 0;
+    bool m_quit = false;
+    QList<QThread*> m_workers;
+};
+
+#endif // METADATA_WRITER_H
@@ -37,6 +37,7 @@
 #include <QPushButton>
 #include <QRandomGenerator>
 #include <QScrollBar>
+#include <QSet>
 #include <QSettings>
 #include <QStackedLayout>
 #include <QStandardPaths>
@@ -48,20 +49,23 @@
 #include <QToolTip>
 #include <QWheelEvent>
 
+#include "BatchTransform.h"
 #include "Bookmarks.h"
 #include "CopyMoveDialog.h"
 #include "CopyMoveToDialog.h"
 #include "ColorsDialog.h"
 #include "DirCompleter.h"
 #include "ExternalAppsDialog.h"
+#include "FileDeleter.h"
 #include "FileListWidget.h"
+#include "FileSystemModel.h"
 #include "FileSystemTree.h"
 #include "GuideWidget.h"
-#include "IconProvider.h"
 #include "ImageViewer.h"
 #include "InfoViewer.h"
 #include "MessageBox.h"
 #include "MetadataCache.h"
+#include "MetadataWriter.h"
 #include "Phototonic.h"
 #include "ProgressDialog.h"
 #include "RangeInputDialog.h"
@@ -70,6 +74,7 @@
 #include "Settings.h"
 #include "SettingsDialog.h"
 #include "Tags.h"
+#include "ThumbnailCache.h"
 #include "ThumbsViewer.h"
 #include "Trashcan.h"
 
@@ -78,9 +83,8 @@
 Phototonic::Phototonic(QStringList argumentsList, int filesStartAt, QWidget *parent) : QMainWindow(parent) {
     Settings::appSettings = new QSettings("phototonic", "phototonic");
 
-    fileSystemModel = new QFileSystemModel(this);
+    fileSystemModel = new FileSystemModel(this);
     fileSystemModel->setFilter(QDir::AllDirs | QDir::Dirs | QDir::NoDotAndDotDot);
-    fileSystemModel->setIconProvider(new IconProvider);
 
     setDockOptions(QMainWindow::AllowNestedDocks);
     readSettings();
@@ -129,6 +133,7 @@ Phototonic::Phototonic(QStringList argumentsList, int filesStartAt, QWidget *par
             if (Settings::layoutMode == ImageViewWidget)
                 setImageViewerWindowTitle();
             imageViewer->loadImage(imagePath, Settings::slideShowActive ? QImage() : thumbsViewer->icon(current.row()).pixmap(THUMB_SIZE_MAX).toImage());
+            preloadImages();
         }
         }, Qt::QueuedConnection);
     connect(qApp, SIGNAL(focusChanged(QWidget * , QWidget * )), this, SLOT(updateActions()));
@@ -229,6 +234,9 @@ void Phototonic::createThumbsViewer() {
     connect(thumbsViewer->selectionModel(), SIGNAL(selectionChanged(QItemSelection, QItemSelection)),
             this, SLOT(updateActions()));
     connect (thumbsViewer, &ThumbsViewer::status, this, &Phototonic::setStatus);
+    connect(MetadataWriter::instance(), &MetadataWriter::failed, this, [=](const QString &imagePath) {
+        setStatus(tr("Failed to save metadata to %1").arg(imagePath));
+    });
     connect (thumbsViewer, &ThumbsViewer::progress, [=](unsigned int v, unsigned int t) {
                 m_progressBar->setMaximum(t);
                 m_progressBar->setValue(v);
@@ -710,6 +718,10 @@ void Phototonic::createActions() {
     m_wallpaperAction->setObjectName("setwallpaper");
     connect(m_wallpaperAction, &QAction::triggered, this, &Phototonic::runExternalApp);
 
+    m_prewarmThumbnailsAction = new QAction(tr("Pre-generate Thumbnails"), this);
+    m_prewarmThumbnailsAction->setObjectName("prewarmThumbnails");
+    connect(m_prewarmThumbnailsAction, &QAction::triggered, this, &Phototonic::prewarmThumbnails);
+
     openWithSubMenu = new QMenu(tr("Open With..."));
     openWithMenuAction = new QAction(tr("Open With..."), this);
     openWithMenuAction->setObjectName("openWithMenu");
@@ -1164,6 +1176,7 @@ void Phototonic::createFileSystemDock() {
     fileSystemTree->addAction(deleteAction);
     fileSystemTree->addAction(deletePermanentlyAction);
     fileSystemTree->addAction(m_wallpaperAction);
+    fileSystemTree->addAction(m_prewarmThumbnailsAction);
     fileSystemTree->addAction(openWithMenuAction);
     fileSystemTree->addAction(addBookmarkAction);
     fileSystemTree->setContextMenuPolicy(Qt::ActionsContextMenu);
@@ -1279,7 +1292,8 @@ void Phototonic::sortThumbnails() {
         thumbsViewer->scanForSort(ThumbsViewer::BrightnessRole);
         thumbModel->setSortRole(ThumbsViewer::BrightnessRole);
     }
-    thumbModel->sort(0, sortReverseAction->isChecked() ? Qt::DescendingOrder : Qt::AscendingOrder);
+    thumbsViewer->thumbsSortOrder = sortReverseAction->isChecked() ? Qt::DescendingOrder : Qt::AscendingOrder;
+    thumbModel->sort(0, thumbsViewer->thumbsSortOrder);
     thumbsViewer->loadVisibleThumbs(-1);
 }
 
@@ -1617,6 +1631,7 @@ void Phototonic::zoom(double multiplier, QPoint focus) {
     multiplier = multiplier > 0.0 ? qMax(0.1, qRound(multiplier*10)*0.1) : qMin(-0.1, qRound(multiplier*10)*0.1);
 
     Settings::imageZoomFactor = qMin(16.0, qMax(0.1, Settings::imageZoomFactor + multiplier));
+    imageViewer->interact();
     imageViewer->resizeImage(focus);
     //: nb the trailing "%" for eg. 80%
     imageViewer->setFeedback(tr("Zoom %1%").arg(QString::number(Settings::imageZoomFactor * 100)));
@@ -1729,7 +1744,8 @@ void Phototonic::batchTransform() {
         return;
     }
     QRect cropRect = imageViewer->lastCropGeometry();
-    if (!cropRect.isValid()) {
+    BatchTransform::Options options;
+    if (!cropRect.isValid() || !imageViewer->batchEdit(&options.transform, &options.size, &options.referenceSize)) {
         msgBox.warning( tr("No crop area defined"),
                         tr( "<h3>Define a crop area</h3>"
                             "<p>Open an image, maybe rotate it.<br>"
@@ -1778,17 +1794,44 @@ void Phototonic::batchTransform() {
         }
     }
 
-    bool keepTransformWas = Settings::keepTransform;
-    Settings::keepTransform = imageViewer->batchMode = true;
-    setUpdatesEnabled(false);
+    options.applyOrientation = Settings::exifRotationEnabled;
+    options.quality = Settings::defaultSaveQuality;
+    options.saveDirectory = Settings::saveDirectory;
+
+    QStringList imagePaths;
     for (QModelIndex i : idxs) {
-        loadSelectedThumbImage(i);
-        imageViewer->applyCropAndRotation();
-        imageViewer->saveImage();
+        imagePaths << thumbsViewer->fullPathOf(i.row());
+    }
+
+    setInterfaceEnabled(false);
+    ProgressDialog *progressDialog = new ProgressDialog(this);
+    progressDialog->show();
+    QStringList failures;
+    BatchTransform batch(options);
+    connect(&batch, &BatchTransform::progress, progressDialog, [=](int done, int total, const QString &imagePath) {
+        progressDialog->opLabel->setText(tr("Transformed %1 of %2: %3").arg(done).arg(total).arg(imagePath));
+    });
+    connect(&batch, &BatchTransform::failed, this, [&failures](const QString &imagePath, const QString &error) {
+        failures << imagePath + ": " + error;
+    });
+    batch.start(imagePaths);
+    while (!batch.wait(30)) {
+        QApplication::processEvents();
+        if (progressDialog->abortOp) {
+            batch.cancel();
+        }
+    }
+    // deliver what the workers reported last
+    QApplication::processEvents();
+    progressDialog->close();
+    progressDialog->deleteLater();
+    setInterfaceEnabled(true);
+
+    if (!failures.isEmpty()) {
+        MessageBox msgBox(this);
+        msgBox.critical(tr("Error"), tr("Failed to transform %n image(s).", "", failures.count()) + "\n" +
+                                     failures.mid(0, 10).join("\n"));
     }
-    Settings::keepTransform = keepTransformWas;
-    imageViewer->batchMode = false;
-    setUpdatesEnabled(true);
     reloadThumbs();
 }
 
@@ -1799,7 +1842,12 @@ void Phototonic::showColorsDialog() {
 
     if (!colorsDialog) {
         colorsDialog = new ColorsDialog(this, imageViewer);
-        connect(colorsDialog, &QDialog::finished, [=](){ Settings::colorsActive = false; setInterfaceEnabled(true); });
+        connect(colorsDialog, &QDialog::finished, [=](){
+            // the dialog only previewed, apply the colours to the whole image
+            imageViewer->refresh();
+            Settings::colorsActive = false;
+            setInterfaceEnabled(true);
+        });
     }
 
     Settings::colorsActive = true;
@@ -1857,7 +1905,10 @@ void Phototonic::pasteThumbs() {
     copyMoveDialog->execute(thumbsViewer, destDir, pasteInCurrDir);
     if (pasteInCurrDir) {
         for (int thumb = 0; thumb < Settings::copyCutFileList.size(); ++thumb) {
-            thumbsViewer->addThumb(Settings::copyCutFileList.at(thumb));
+            // live updates may have brought it in already while it was copied
+            if (thumbsViewer->rowOf(Settings::copyCutFileList.at(thumb)) < 0) {
+                thumbsViewer->addThumb(Settings::copyCutFileList.at(thumb));
+            }
         }
     } else if (thumbsViewer->model()->rowCount()) {
         thumbsViewer->setCurrentIndex(qMin(copyMoveDialog->latestRow, thumbsViewer->model()->rowCount() - 1));
@@ -1933,57 +1984,50 @@ void Phototonic::deleteImages(bool trash) { // Deleting selected thumbnails
     m_deleteInProgress = true;
 
     ProgressDialog *progressDialog = nullptr;
-    int deleteFilesCount = 0;
-    QList<int> rows;
-
-    for (QString fileNameFullPath : deathRow) {
-
+    QStringList failures;
+    FileDeleter deleter(trash);
+    connect(&deleter, &FileDeleter::progress, this, [&](int done, int total, const QString &fileNameFullPath) {
         // Only show if it takes a lot of time, since popping this up for just
         // deleting a single image is annoying
         if (timer.elapsed() > 100) {
             if (!progressDialog)
                progressDialog = new ProgressDialog(this);
-            progressDialog->opLabel->setText(tr("Deleting %1").arg(fileNameFullPath));
+            progressDialog->opLabel->setText(tr("Deleting %1, %2 of %3").arg(fileNameFullPath).arg(done).arg(total));
             progressDialog->show();
         }
-
-        QString deleteError;
-        bool deleteOk;
-        if (trash) {
-            deleteOk = Trash::moveToTrash(fileNameFullPath, deleteError) == Trash::Success;
-        } else {
-            QFile fileToRemove(fileNameFullPath);
-            deleteOk = fileToRemove.remove();
-            if (!deleteOk) {
-                deleteError = fileToRemove.errorString();
-            }
-        }
-
-        ++deleteFilesCount;
-        if (deleteOk) {
-            QModelIndexList indexList = thumbsViewer->model()->match(thumbsViewer->model()->index(0, 0), ThumbsViewer::FileNameRole, fileNameFullPath);
-            if (indexList.size()) {
-                rows << indexList.at(0).row();
-                thumbsViewer->model()->removeRow(rows.last());
-            }
-        } else {
-            MessageBox msgBox(this);
-            msgBox.critical(tr("Error"),
-                            (trash ? tr("Failed to move image to the trash.") : tr("Failed to delete image.")) + "\n" +
-                            deleteError);
-            break;
+    });
+    connect(&deleter, &FileDeleter::failed, this, [&failures](const QString &fileNameFullPath, const QString &error) {
+        failures << fileNameFullPath + ": " + error;
+    });
+    deleter.start(deathRow);
+    while (!deleter.wait(30)) {
+        QApplication::processEvents();
+        if (progressDialog && progressDialog->abortOp) {
+            deleter.cancel();
         }
+    }
+    // deliver what the workers reported last
+    QApplication::processEvents();
 
-        Settings::filesList.removeOne(fileNameFullPath);
+    const QStringList deletedFiles = deleter.deletedFiles();
+    const QSet<QString> deleted(deletedFiles.begin(), deletedFiles.end());
+    Settings::filesList.removeIf([&deleted](const QString &fileNameFullPath) {
+        return deleted.contains(fileNameFullPath);
+    });
 
-        if (progressDialog && progressDialog->abortOp) {
-            break;
+    QList<int> rows;
+    int firstRow = -1;
+    for (const QString &fileNameFullPath : deletedFiles) {
+        const int row = thumbsViewer->rowOf(fileNameFullPath);
+        if (row > -1) {
+            rows << row;
+            firstRow = firstRow < 0 ? row : qMin(firstRow, row);
         }
     }
+    thumbsViewer->removeThumbRows(rows);
 
-    if (thumbsViewer->model()->rowCount() && rows.count()) {
-        std::sort(rows.begin(), rows.end());
-        thumbsViewer->setCurrentIndex(qMax(rows.at(0), thumbsViewer->model()->rowCount() - 1));
+    if (thumbsViewer->model()->rowCount() && firstRow > -1) {
+        thumbsViewer->setCurrentIndex(qMin(firstRow, thumbsViewer->model()->rowCount() - 1));
     }
 
     if (progressDialog) {
@@ -1991,7 +2035,15 @@ void Phototonic::deleteImages(bool trash) { // Deleting selected thumbnails
         progressDialog->deleteLater();
     }
 
-    setStatus(tr("Deleted %n image(s)", "", deleteFilesCount));
+    if (!failures.isEmpty()) {
+        MessageBox msgBox(this);
+        msgBox.critical(tr("Error"),
+                        (trash ? tr("Failed to move %n image(s) to the trash.", "", failures.count())
+                               : tr("Failed to delete %n image(s).", "", failures.count())) + "\n" +
+                        failures.mid(0, 10).join("\n"));
+    }
+
+    setStatus(tr("Deleted %n image(s)", "", deletedFiles.count()));
 
     m_deleteInProgress = false;
 }
@@ -2239,6 +2291,8 @@ void Phototonic::writeSettings() {
     Settings::setValue(Settings::optionShowViewerToolbar, (bool) Settings::showViewerToolbar);
     Settings::setValue(Settings::optionSetWindowIcon, (bool) Settings::setWindowIcon);
     Settings::setValue(Settings::optionUpscalePreview, (bool) Settings::upscalePreview);
+    Settings::setValue(Settings::optionLosslessRotation, (bool) Settings::losslessRotation);
+    Settings::setValue(Settings::optionTagSidecars, (bool) Settings::tagSidecars);
 
     /* Action shortcuts */
     Settings::beginGroup(Settings::optionShortcuts);
@@ -2320,6 +2374,8 @@ void Phototonic::readSettings() {
         Settings::setValue(Settings::optionShowViewerToolbar, (bool) false);
         Settings::setValue(Settings::optionSmallToolbarIcons, (bool) true);
         Settings::setValue(Settings::optionUpscalePreview, (bool) false);
+        Settings::setValue(Settings::optionLosslessRotation, (bool) true);
+        Settings::setValue(Settings::optionTagSidecars, (bool) false);
         Settings::bookmarkPaths.insert(QDir::homePath());
         const QString picturesLocation = QStandardPaths::writableLocation(QStandardPaths::PicturesLocation);
         if (!picturesLocation.isEmpty()) {
@@ -2365,6 +2421,8 @@ void Phototonic::readSettings() {
     Settings::showViewerToolbar = Settings::value(Settings::optionShowViewerToolbar).toBool();
     Settings::setWindowIcon = Settings::value(Settings::optionSetWindowIcon).toBool();
     Settings::upscalePreview = Settings::value(Settings::optionUpscalePreview).toBool();
+    Settings::losslessRotation = Settings::value(Settings::optionLosslessRotation).toBool();
+    Settings::tagSidecars = Settings::value(Settings::optionTagSidecars).toBool();
 
     Settings::wallpaperCommand = Settings::value(Settings::optionWallpaperCommand).toString();
     /* read external apps */
@@ -2598,6 +2656,10 @@ void Phototonic::loadShortcuts() {
 
 void Phototonic::closeEvent(QCloseEvent *event) {
     thumbsViewer->abort(true);
+    MetadataWriter::instance()->flush();
+    if (m_thumbnailWarmer) {
+        m_thumbnailWarmer->cancel();
+    }
     writeSettings();
     hide();
     QClipboard *clip = QApplication::clipboard();
@@ -2838,7 +2900,7 @@ void Phototonic::slideShowHandler() {
     if (!Settings::slideShowActive) {
         next = -1;
         last = -1;
-        imageViewer->preload("");
+        preloadImages();
         return;
     }
 
@@ -2862,7 +2924,56 @@ void Phototonic::slideShowHandler() {
     }
 
     if (next > -1 && next < thumbsViewer->model()->rowCount())
-        QTimer::singleShot(500, this, [=]() {imageViewer->preload(thumbsViewer->fullPathOf(next));});
+        QTimer::singleShot(500, this, [=]() { preloadImages(next); });
+}
+
+// Keeps the images around the current one decoded, in the direction we're moving first
+void Phototonic::preloadImages(int randomNext) {
+    static const int preloadAhead = 2;
+    static const int preloadBehind = 1;
+    static int lastRow = -1;
+    static int step = 1;
+
+    const int rowCount = thumbsViewer->model()->rowCount();
+    const int currentRow = thumbsViewer->currentIndex().row();
+    if (Settings::layoutMode != ImageViewWidget || currentRow < 0) {
+        imageViewer->preload(QStringList());
+        return;
+    }
+
+    if (currentRow != lastRow && lastRow > -1) {
+        const bool wrappedForward = currentRow == 0 && lastRow == rowCount - 1;
+        const bool wrappedBackward = currentRow == rowCount - 1 && lastRow == 0;
+        step = (currentRow < lastRow && !wrappedForward) || wrappedBackward ? -1 : 1;
+    }
+    lastRow = currentRow;
+
+    QStringList imagePaths;
+    auto addRow = [&](int row) {
+        if (row < 0 || row >= rowCount) {
+            if (!Settings::wrapImageList || rowCount < 1) {
+                return;
+            }
+            row = (row % rowCount + rowCount) % rowCount;
+        }
+        const QString imagePath = thumbsViewer->fullPathOf(row);
+        if (row != currentRow && !imagePaths.contains(imagePath)) {
+            imagePaths.append(imagePath);
+        }
+    };
+
+    if (randomNext > -1) {
+        addRow(randomNext);
+    }
+    if (!(Settings::slideShowActive && Settings::slideShowRandom)) {
+        for (int i = 1; i <= preloadAhead; ++i) {
+            addRow(currentRow + i * step);
+        }
+    }
+    for (int i = 1; i <= preloadBehind; ++i) {
+        addRow(currentRow - i * step);
+    }
+    imageViewer->preload(imagePaths);
 }
 
 void Phototonic::loadImage(SpecialImageIndex idx) {
@@ -2922,6 +3033,7 @@ void Phototonic::hideViewer() {
 
     Settings::layoutMode = ThumbViewWidget;
     stackedLayout->setCurrentWidget(thumbsViewer);
+    preloadImages();
 
     setDocksVisibility(true);
     while (QApplication::overrideCursor()) {
@@ -3302,32 +3414,15 @@ void Phototonic::removeMetadata() {
     msgBox.exec();
 
     if (msgBox.clickedButton() == yesButton) {
-        for (int file = 0; file < fileList.size(); ++file) {
-
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wdeprecated-declarations"
-#if EXIV2_TEST_VERSION(0,28,0)
-            Exiv2::Image::UniquePtr image;
-#else
-            Exiv2::Image::AutoPtr image;
-#endif
-#pragma clang diagnostic pop
-
-            try {
-                image = Exiv2::ImageFactory::open(fileList[file].toStdString());
-                image->clearMetadata();
-                image->writeMetadata();
-                Metadata::forget(fileList[file]);
-            }
-            catch (Exiv2::Error &error) {
-                msgBox.critical(tr("Error"), tr("Failed to remove Exif metadata."));
-                return;
-            }
+        MetadataWriter *writer = MetadataWriter::instance();
+        for (const QString &imagePath : fileList) {
+            writer->clearMetadata(imagePath);
         }
-
-        thumbsViewer->onSelectionChanged();
-        QString state = QString(tr("Metadata removed from selected images"));
-        setStatus(state);
+        connect(writer, &MetadataWriter::idle, this, [=]() {
+            thumbsViewer->onSelectionChanged();
+            setStatus(tr("Metadata removed from selected images"));
+        }, Qt::SingleShotConnection);
+        setStatus(tr("Removing metadata from %n image(s)", "", fileList.count()));
     }
 }
 
@@ -3422,6 +3517,38 @@ void Phototonic::setSaveDirectory(QString path) {
         path;
 }
 
+void Phototonic::prewarmThumbnails() {
+    const QString path = getSelectedPath();
+    if (path.isEmpty()) {
+        return;
+    }
+    // one crawl at a time, the old one finishes the images it is on and goes away
+    if (m_thumbnailWarmer) {
+        m_thumbnailWarmer->cancel();
+    }
+
+    // leave enough of the machine to browsing, which is what this is for
+    ThumbnailWarmer *warmer = new ThumbnailWarmer(qMax(1, QThread::idealThreadCount() / 2), 2, true, this);
+    m_thumbnailWarmer = warmer;
+    connect(warmer, &ThumbnailWarmer::progress, this, [=](int done, int total) {
+        if (done % 16 == 0) {
+            setStatus(tr("Generating thumbnails: %1 of %2").arg(done).arg(total));
+        }
+    });
+    connect(warmer, &ThumbnailWarmer::finished, this, [=]() {
+        if (m_thumbnailWarmer == warmer) {
+            if (warmer->failedCount()) {
+                setStatus(tr("Generated thumbnails for %1, %2 images failed").arg(path).arg(warmer->failedCount()));
+            } else {
+                setStatus(tr("Generated thumbnails for %1").arg(path));
+            }
+        }
+        warmer->deleteLater();
+    });
+    warmer->start({path});
+    setStatus(tr("Generating thumbnails for %1").arg(path));
+}
+
 QString Phototonic::getSelectedPath() {
     if (!fileSystemTree->selectionModel())
         return Settings::currentDirectory; // if there's no filesystem tree, this means the open directory
@@ -27,6 +27,7 @@ class FileSystemTree;
 class ImageViewer;
 class InfoView;
 class SettingsDialog;
+class ThumbnailWarmer;
 class ThumbsViewer;
 class QFileSystemModel;
 class QLabel;
@@ -151,6 +152,8 @@ private slots:
 
     void batchTransform();
 
+    void prewarmThumbnails();
+
     void showColorsDialog();
 
     void flipHorizontal();
@@ -283,10 +286,12 @@ private:
     QAction *openWithMenuAction;
     QAction *externalAppsAction;
     QAction *m_wallpaperAction;
+    QAction *m_prewarmThumbnailsAction;
     QAction *invertSelectionAction;
     QAction *batchTransformAction;
     QAction *feedbackImageInfoAction;
 
+    QPointer<ThumbnailWarmer> m_thumbnailWarmer;
     QProgressBar *m_progressBar;
     QAction *m_progressBarAction;
     QLineEdit *pathLineEdit;
@@ -335,6 +340,7 @@ private:
 
     void refreshThumbs(bool noScroll);
     void loadImage(SpecialImageIndex idx);
+    void preloadImages(int randomNext = -1);
     void loadShortcuts();
 
     void setupDocks();
@@ -67,6 +67,8 @@ namespace Settings {
     const char optionKnownTags[] = "KnownTags";
     const char optionSetWindowIcon[] = "setWindowIcon";
     const char optionUpscalePreview[] = "upscalePreview";
+    const char optionLosslessRotation[] = "losslessRotation";
+    const char optionTagSidecars[] = "tagSidecars";
     const char optionScrollZooms[] = "scrollZooms";
 
     QSettings *appSettings;
@@ -145,6 +147,8 @@ namespace Settings {
     bool isFileListLoaded;
     bool setWindowIcon;
     bool upscalePreview;
+    bool losslessRotation;
+    bool tagSidecars;
     bool scrollZooms;
 }
 
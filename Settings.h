@@ -83,6 +83,8 @@ namespace Settings {
     extern const char optionKnownTags[];
     extern const char optionSetWindowIcon[];
     extern const char optionUpscalePreview[];
+    extern const char optionLosslessRotation[];
+    extern const char optionTagSidecars[];
     extern const char optionScrollZooms[];
 
     extern QSettings *appSettings;
@@ -162,6 +164,8 @@ namespace Settings {
     extern bool isFileListLoaded;
     extern bool setWindowIcon;
     extern bool upscalePreview;
+    extern bool losslessRotation;
+    extern bool tagSidecars;
     extern bool scrollZooms;
 }
 
@@ -104,6 +104,10 @@ SettingsDialog::SettingsDialog(QWidget *parent) : QDialog(parent) {
     enableExifCheckBox = new QCheckBox(tr("Rotate image according to Exif orientation value"), this);
     enableExifCheckBox->setChecked(Settings::exifRotationEnabled);
 
+    // Lossless JPEG rotation
+    losslessRotationCheckBox = new QCheckBox(tr("Save rotated or flipped JPEG images by changing their Exif orientation"), this);
+    losslessRotationCheckBox->setChecked(Settings::losslessRotation);
+
     // Image name
     showImageNameCheckBox = new QCheckBox(tr("Show image file name in viewer"), this);
     showImageNameCheckBox->setChecked(Settings::showImageName);
@@ -119,6 +123,7 @@ SettingsDialog::SettingsDialog(QWidget *parent) : QDialog(parent) {
     viewerOptsBox->addLayout(zoomOptsBox);
     viewerOptsBox->addLayout(backgroundColorHBox);
     viewerOptsBox->addWidget(enableExifCheckBox);
+    viewerOptsBox->addWidget(losslessRotationCheckBox);
     viewerOptsBox->addWidget(showImageNameCheckBox);
     viewerOptsBox->addWidget(wrapListCheckBox);
     viewerOptsBox->addWidget(enableAnimCheckBox);
@@ -210,6 +215,10 @@ SettingsDialog::SettingsDialog(QWidget *parent) : QDialog(parent) {
     deleteConfirmCheckBox = new QCheckBox(tr("Delete confirmation"), this);
     deleteConfirmCheckBox->setChecked(Settings::deleteConfirm);
 
+    // Tags in sidecar files
+    tagSidecarsCheckBox = new QCheckBox(tr("Save tags to XMP sidecar files instead of the images"), this);
+    tagSidecarsCheckBox->setChecked(Settings::tagSidecars);
+
     // Startup directory
     QGroupBox *startupDirGroupBox = new QGroupBox(tr("Startup directory if not specified by command line"));
     startupDirectoryRadioButtons[Settings::RememberLastDir] = new QRadioButton(tr("Remember last"));
@@ -278,6 +287,7 @@ SettingsDialog::SettingsDialog(QWidget *parent) : QDialog(parent) {
     QVBoxLayout *generalSettingsLayout = new QVBoxLayout;
     generalSettingsLayout->addWidget(reverseMouseCheckBox);
     generalSettingsLayout->addWidget(deleteConfirmCheckBox);
+    generalSettingsLayout->addWidget(tagSidecarsCheckBox);
     generalSettingsLayout->addWidget(startupDirGroupBox);
     generalSettingsLayout->addWidget(scrollZoomCheckBox);
 
@@ -374,11 +384,13 @@ void SettingsDialog::saveSettings() {
     Settings::slideShowRandom = slideRandomCheckBox->isChecked();
     Settings::enableAnimations = enableAnimCheckBox->isChecked();
     Settings::exifRotationEnabled = enableExifCheckBox->isChecked();
+    Settings::losslessRotation = losslessRotationCheckBox->isChecked();
     Settings::exifThumbRotationEnabled = enableThumbExifCheckBox->isChecked();
     Settings::showImageName = showImageNameCheckBox->isChecked();
     Settings::reverseMouseBehavior = reverseMouseCheckBox->isChecked();
     Settings::scrollZooms = scrollZoomCheckBox->isChecked();
     Settings::deleteConfirm = deleteConfirmCheckBox->isChecked();
+    Settings::tagSidecars = tagSidecarsCheckBox->isChecked();
     Settings::setWindowIcon = setWindowIconCheckBox->isChecked();
     Settings::upscalePreview = upscalePreviewCheckBox->isChecked();
 
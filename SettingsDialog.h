@@ -67,11 +67,13 @@ private:
     QCheckBox *wrapListCheckBox;
     QCheckBox *enableAnimCheckBox;
     QCheckBox *enableExifCheckBox;
+    QCheckBox *losslessRotationCheckBox;
     QCheckBox *enableThumbExifCheckBox;
     QCheckBox *showImageNameCheckBox;
     QCheckBox *reverseMouseCheckBox;
     QCheckBox *scrollZoomCheckBox;
     QCheckBox *deleteConfirmCheckBox;
+    QCheckBox *tagSidecarsCheckBox;
     QSpinBox *slideDelaySpinBox;
     QCheckBox *slideRandomCheckBox;
     QRadioButton *startupDirectoryRadioButtons[3];
@@ -3,162 +3,242 @@
 #include <QtMath>
 #include <QElapsedTimer>
 
-namespace SmartCrop {
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-static inline qreal cie(qreal r, qreal g, qreal b) {
-    return 0.5126 * b + 0.7152 * g + 0.0722 * r;
-}
+namespace SmartCrop {
 
-static inline qreal sample(const uchar *id, int p) {
-    return cie(id[p], id[p + 1], id[p + 2]);
+static inline float cie(float r, float g, float b) {
+    return 0.5126f * b + 0.7152f * g + 0.0722f * r;
 }
 
-static void edgeDetect(const QImage &i, QImage &o) {
-    const int bpl = i.bytesPerLine();//: width();
-    const uchar *id = i.scanLine(0);
-    const int h = i.height();
-
-    for (int y = 0; y < h; y++) {
-        uchar *od = o.scanLine(y);
-        for (int x = 0; x < i.width(); x++) {
-            int p = y * bpl + x * 4;
-            qreal lightness;
+struct FeatureThresholds {
+    float skinR, skinG, skinB;
+    float skinThreshold;
+    float maxSkinDistance2;
+    float skinScale;
+    float skinBrightnessMin, skinBrightnessMax;
+    float saturationThreshold;
+    float saturationScale;
+    float saturationBrightnessMin, saturationBrightnessMax;
+};
 
-            if (x == 0 || x >= i.width() - 1 || y == 0 || y >= h - 1) {
-                lightness = sample(id, p);
-            } else {
-                lightness = sample(id, p) * 4. -
-                        sample(id, p - bpl) -
-                        sample(id, p - 4) -
-                        sample(id, p + 4) -
-                        sample(id, p + bpl);
-            }
+static void lightnessRow(const uchar *id, float *l, int w) {
+    for (int x = 0; x < w; x++) {
+        const int p = x * 4;
+        l[x] = cie(id[p], id[p + 1], id[p + 2]);
+    }
+}
 
-            od[x * 4 + 1] = qMax<int>(lightness, 0);
+// skin (r), edge (g) and saturation (b) of a single pixel, the alpha channel is passed through for the boost
+static inline void featurePixel(const FeatureThresholds &t, const uchar *id, uchar *od, float l, float edge) {
+    const int r = id[0];
+    const int g = id[1];
+    const int b = id[2];
+
+    od[1] = qMax<int>(edge, 0);
+
+    od[0] = 0;
+    const float mag2 = float(r * r + g * g + b * b);
+    if (mag2 > 0.f && l >= t.skinBrightnessMin && l <= t.skinBrightnessMax) {
+        const float invMag = 1.f / std::sqrt(mag2);
+        const float rd = r * invMag - t.skinR;
+        const float gd = g * invMag - t.skinG;
+        const float bd = b * invMag - t.skinB;
+        const float d2 = rd * rd + gd * gd + bd * bd;
+        if (d2 < t.maxSkinDistance2) {
+            od[0] = (1.f - std::sqrt(d2) - t.skinThreshold) * t.skinScale;
         }
     }
-}
 
-static qreal skinColor(const CropOptions &options, qreal r,qreal g, qreal b) {
-    qreal mag = sqrt(r * r + g * g + b * b);
-    if (Q_UNLIKELY(mag == 0.)) {
-        return 0.;
+    od[2] = 0;
+    const int maximum = qMax(r, qMax(g, b));
+    const int minimum = qMin(r, qMin(g, b));
+    if (maximum != minimum && l >= t.saturationBrightnessMin && l <= t.saturationBrightnessMax) {
+        const int sum = maximum + minimum;
+        const float sat = float(maximum - minimum) / (sum > 255 ? 510 - sum : sum);
+        if (sat > t.saturationThreshold) {
+            od[2] = (sat - t.saturationThreshold) * t.saturationScale;
+        }
     }
-    qreal rd = r / mag - options.skinColor[0];
-    qreal gd = g / mag - options.skinColor[1];
-    qreal bd = b / mag - options.skinColor[2];
-    qreal d = sqrt(rd * rd + gd * gd + bd * bd);
-    return 1 - d;
-}
 
-static void skinDetect(const CropOptions &options, const QImage &i, QImage &o) {
-    int w = i.width();
-    int h = i.height();
+    od[3] = id[3];
+}
 
-    for (int y = 0; y < h; y++) {
-        uchar *od = o.scanLine(y);
-        const uchar *id = i.scanLine(y) ;
-        for (int x = 0; x < w; x++) {
-            int p = x * 4;
-            qreal lightness = cie(id[p], id[p + 1], id[p + 2]) / 255.;
-            qreal skin = skinColor(options, id[p], id[p + 1], id[p + 2]);
-            bool isSkinColor = skin > options.skinThreshold;
-            bool isSkinBrightness =
-                    lightness >= options.skinBrightnessMin &&
-                    lightness <= options.skinBrightnessMax;
-            if (isSkinColor && isSkinBrightness) {
-                od[p] =
-                        (skin - options.skinThreshold) *
-                        (255. / (1. - options.skinThreshold));
-            } else {
-                od[p] = 0;
-            }
-        }
+#ifdef __SSE2__
+// Four RGBA8888 pixels fill one register, so the channels are masked out of the 32 bit lanes and the
+// detectors run on four pixels at once. The conditions become masks, the arithmetic is the same
+// single precision as featurePixel(), so both give identical bytes. Returns the first pixel left over.
+static int featurePixelsSse2(const FeatureThresholds &t, const uchar *id, uchar *od,
+                             const float *above, const float *l, const float *below, int x, int end) {
+    const __m128i byteMask = _mm_set1_epi32(0xff);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    for (; x + 4 <= end; x += 4) {
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(id + x * 4));
+        const __m128i ri = _mm_and_si128(pixels, byteMask);
+        const __m128i gi = _mm_and_si128(_mm_srli_epi32(pixels, 8), byteMask);
+        const __m128i bi = _mm_and_si128(_mm_srli_epi32(pixels, 16), byteMask);
+        const __m128i ai = _mm_srli_epi32(pixels, 24);
+        const __m128 r = _mm_cvtepi32_ps(ri);
+        const __m128 g = _mm_cvtepi32_ps(gi);
+        const __m128 b = _mm_cvtepi32_ps(bi);
+        const __m128 lightness = _mm_loadu_ps(l + x);
+
+        // edges
+        __m128 edge = _mm_sub_ps(_mm_mul_ps(lightness, _mm_set1_ps(4.f)), _mm_loadu_ps(above + x));
+        edge = _mm_sub_ps(edge, _mm_loadu_ps(l + x - 1));
+        edge = _mm_sub_ps(edge, _mm_loadu_ps(l + x + 1));
+        edge = _mm_sub_ps(edge, _mm_loadu_ps(below + x));
+        const __m128i edgeByte = _mm_and_si128(_mm_cvttps_epi32(_mm_max_ps(edge, zero)), byteMask);
+
+        // skin
+        const __m128 mag2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(g, g)), _mm_mul_ps(b, b));
+        const __m128 invMag = _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(mag2, one)));
+        const __m128 rd = _mm_sub_ps(_mm_mul_ps(r, invMag), _mm_set1_ps(t.skinR));
+        const __m128 gd = _mm_sub_ps(_mm_mul_ps(g, invMag), _mm_set1_ps(t.skinG));
+        const __m128 bd = _mm_sub_ps(_mm_mul_ps(b, invMag), _mm_set1_ps(t.skinB));
+        const __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rd, rd), _mm_mul_ps(gd, gd)), _mm_mul_ps(bd, bd));
+        __m128 isSkin = _mm_and_ps(_mm_cmpgt_ps(mag2, zero), _mm_cmplt_ps(d2, _mm_set1_ps(t.maxSkinDistance2)));
+        isSkin = _mm_and_ps(isSkin, _mm_cmpge_ps(lightness, _mm_set1_ps(t.skinBrightnessMin)));
+        isSkin = _mm_and_ps(isSkin, _mm_cmple_ps(lightness, _mm_set1_ps(t.skinBrightnessMax)));
+        const __m128 skin = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(one, _mm_sqrt_ps(d2)), _mm_set1_ps(t.skinThreshold)),
+                                       _mm_set1_ps(t.skinScale));
+        const __m128i skinByte = _mm_and_si128(_mm_cvttps_epi32(_mm_and_ps(isSkin, skin)), byteMask);
+
+        // saturation, the channels are whole numbers so float max and min are exact
+        const __m128 maximum = _mm_max_ps(r, _mm_max_ps(g, b));
+        const __m128 minimum = _mm_min_ps(r, _mm_min_ps(g, b));
+        const __m128 sum = _mm_add_ps(maximum, minimum);
+        const __m128 bright = _mm_cmpgt_ps(sum, _mm_set1_ps(255.f));
+        const __m128 divisor = _mm_or_ps(_mm_and_ps(bright, _mm_sub_ps(_mm_set1_ps(510.f), sum)),
+                                         _mm_andnot_ps(bright, sum));
+        const __m128 sat = _mm_div_ps(_mm_sub_ps(maximum, minimum), _mm_max_ps(divisor, one));
+        __m128 isSaturated = _mm_and_ps(_mm_cmpneq_ps(maximum, minimum),
+                                        _mm_cmpgt_ps(sat, _mm_set1_ps(t.saturationThreshold)));
+        isSaturated = _mm_and_ps(isSaturated, _mm_cmpge_ps(lightness, _mm_set1_ps(t.saturationBrightnessMin)));
+        isSaturated = _mm_and_ps(isSaturated, _mm_cmple_ps(lightness, _mm_set1_ps(t.saturationBrightnessMax)));
+        const __m128 saturation = _mm_mul_ps(_mm_sub_ps(sat, _mm_set1_ps(t.saturationThreshold)),
+                                             _mm_set1_ps(t.saturationScale));
+        const __m128i saturationByte = _mm_and_si128(_mm_cvttps_epi32(_mm_and_ps(isSaturated, saturation)), byteMask);
+
+        __m128i features = _mm_or_si128(skinByte, _mm_slli_epi32(edgeByte, 8));
+        features = _mm_or_si128(features, _mm_slli_epi32(saturationByte, 16));
+        features = _mm_or_si128(features, _mm_slli_epi32(ai, 24));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(od + x * 4), features);
     }
+    return x;
 }
-static qreal saturation(qreal r, qreal g, qreal b) {
-    qreal maximum = qMax(r / 255., qMax(g / 255., b / 255.));
-    qreal minimum = qMin(r / 255., qMin(g / 255., b / 255.));
+#endif
 
-    if (qFuzzyCompare(maximum, minimum)) {
-        return 0;
+// Runs the skin (r), edge (g) and saturation (b) detectors in a single pass, the alpha channel is
+// passed through for the boost. The lightness the edge kernel needs is kept for three rows only.
+// Inner pixels go four at a time through SSE2 where the target has it, which every x86-64 does.
+static QImage detectFeatures(const CropOptions &options, const QImage &i) {
+    const int w = i.width();
+    const int h = i.height();
+    QImage o(w, h, QImage::Format_RGBA8888);
+    if (o.isNull()) {
+        return o;
     }
 
-    qreal l = (maximum + minimum) / 2.;
-    qreal d = maximum - minimum;
+    FeatureThresholds t;
+    t.skinR = options.skinColor[0];
+    t.skinG = options.skinColor[1];
+    t.skinB = options.skinColor[2];
+    t.skinThreshold = options.skinThreshold;
+    // skin > threshold <=> distance to the skin color < 1 - threshold, test that squared and spare the root
+    const float maxSkinDistance = qMax(0.f, 1.f - t.skinThreshold);
+    t.maxSkinDistance2 = maxSkinDistance * maxSkinDistance;
+    t.skinScale = 255.f / (1.f - t.skinThreshold);
+    t.skinBrightnessMin = options.skinBrightnessMin * 255.;
+    t.skinBrightnessMax = options.skinBrightnessMax * 255.;
+    t.saturationThreshold = options.saturationThreshold;
+    t.saturationScale = 255.f / (1.f - t.saturationThreshold);
+    t.saturationBrightnessMin = options.saturationBrightnessMin * 255.;
+    t.saturationBrightnessMax = options.saturationBrightnessMax * 255.;
+
+    QVector<float> rows(w * 3);
+    float *above = rows.data();
+    float *l = above + w;
+    float *below = l + w;
+    lightnessRow(i.constScanLine(0), l, w);
+    if (h > 1) {
+        lightnessRow(i.constScanLine(1), below, w);
+    }
 
-    return l > 0.5 ? d / (2. - maximum - minimum) : d / (maximum + minimum);
-}
-static void saturationDetect(const CropOptions &options, const QImage &i, QImage &o) {
-    int w = i.width();
-    int h = i.height();
     for (int y = 0; y < h; y++) {
+        const uchar *id = i.constScanLine(y);
         uchar *od = o.scanLine(y);
-        const uchar *id = i.scanLine(y);
-        for (int x = 0; x < w; x++) {
-            int p = x * 4;
-
-            qreal lightness = cie(id[p], id[p + 1], id[p + 2]) / 255.;
-            qreal sat = saturation(id[p], id[p + 1], id[p + 2]);
-
-            bool acceptableSaturation = sat > options.saturationThreshold;
-            bool acceptableLightness =
-                    lightness >= options.saturationBrightnessMin &&
-                    lightness <= options.saturationBrightnessMax;
-            if (acceptableLightness && acceptableSaturation) {
-                od[p + 2] =
-                        (sat - options.saturationThreshold) *
-                        (255. / (1 - options.saturationThreshold));
-            } else {
-                od[p + 2] = 0;
+        if (y == 0 || y >= h - 1 || w < 3) {
+            for (int x = 0; x < w; x++) {
+                featurePixel(t, id + x * 4, od + x * 4, l[x], l[x]);
             }
+        } else {
+            featurePixel(t, id, od, l[0], l[0]);
+            int x = 1;
+#ifdef __SSE2__
+            x = featurePixelsSse2(t, id, od, above, l, below, x, w - 1);
+#endif
+            for (; x < w - 1; x++) {
+                const float edge = l[x] * 4.f - above[x] - l[x - 1] - l[x + 1] - below[x];
+                featurePixel(t, id + x * 4, od + x * 4, l[x], edge);
+            }
+            featurePixel(t, id + (w - 1) * 4, od + (w - 1) * 4, l[w - 1], l[w - 1]);
+        }
+
+        // move the window down a row
+        std::swap(above, l);
+        std::swap(l, below);
+        if (y + 2 < h) {
+            lightnessRow(i.constScanLine(y + 2), below, w);
         }
     }
+    return o;
 }
 
-static QImage downSample(QImage &input, qreal factor) {
+static QImage downSample(const QImage &input, qreal factor) {
     int width = qFloor(input.width() / factor);
     int height = qFloor(input.height() / factor);
     QImage output(width, height, QImage::Format_RGBA8888);
-    qreal ifactor2 = 1. / (factor * factor);
-    for (int y = 0; y < height; y++) {
-        uchar *data = output.scanLine(y);
-        for (int x = 0; x < width; x++) {
-            int i = x * 4;
+    const int span = qCeil(factor);
+    const float ifactor2 = 1. / (factor * factor);
 
-            qreal r = 0;
-            qreal g = 0;
-            qreal b = 0;
-            qreal a = 0;
-
-            qreal mr = 0;
-            qreal mg = 0;
-
-            for (int v = 0; v < factor; v++) {
-                uchar *idata = input.scanLine(y * factor + v);
-                for (int u = 0; u < factor; u++) {
-                    int j = (x * factor + u) * 4;
-                    r += idata[j];
-                    g += idata[j + 1];
-                    b += idata[j + 2];
-                    a += idata[j + 3];
-                    mr = qMax(mr, qreal(idata[j]));
-                    mg = qMax(mg, qreal(idata[j + 1]));
+    // accumulate r, g, b, a and the r and g maxima of a full output row while streaming the input rows
+    QVector<int> sums(width * 6);
+    for (int y = 0; y < height; y++) {
+        sums.fill(0);
+        for (int v = 0; v < span; v++) {
+            const uchar *idata = input.constScanLine(int(y * factor + v));
+            int *sum = sums.data();
+            for (int x = 0; x < width; x++, sum += 6) {
+                const uchar *pixel = idata + int(x * factor) * 4;
+                for (int u = 0; u < span; u++, pixel += 4) {
+                    sum[0] += pixel[0];
+                    sum[1] += pixel[1];
+                    sum[2] += pixel[2];
+                    sum[3] += pixel[3];
+                    sum[4] = qMax<int>(sum[4], pixel[0]);
+                    sum[5] = qMax<int>(sum[5], pixel[1]);
                 }
             }
+        }
+        uchar *data = output.scanLine(y);
+        const int *sum = sums.constData();
+        for (int x = 0; x < width; x++, sum += 6) {
+            int i = x * 4;
             // this is some funky magic to preserve detail a bit more for
             // skin (r) and detail (g). Saturation (b) does not get this boost.
-            data[i] = r * ifactor2 * 0.5 + mr * 0.5;
-            data[i + 1] = g * ifactor2 * 0.7 + mg * 0.3;
-            data[i + 2] = b * ifactor2;
-            data[i + 3] = a * ifactor2;
+            data[i] = sum[0] * ifactor2 * 0.5f + sum[4] * 0.5f;
+            data[i + 1] = sum[1] * ifactor2 * 0.7f + sum[5] * 0.3f;
+            data[i + 2] = sum[2] * ifactor2;
+            data[i + 3] = sum[3] * ifactor2;
         }
     }
     return output;
 }
 
-struct ScoreResult {
-};
 // Gets value in the range of [0, 1] where 0 is the center of the pictures
 // returns weight of rule of thirds [0, 1]
 static qreal thirds(qreal x) {
@@ -166,19 +246,14 @@ static qreal thirds(qreal x) {
     return qMax(1.0 - x * x, 0.0);
 }
 
-static inline qreal importance(const CropOptions &options, const QRectF &crop, qreal x, qreal y) {
-    if (
-            crop.x() > x ||
-            x >= crop.x() + crop.width() ||
-            crop.y() > y ||
-            y >= crop.y() + crop.height()
-            ) {
-        return options.outsideImportance;
-    }
-    x = (x - crop.x()) / qreal(crop.width());
-    y = (y - crop.y()) / qreal(crop.height());
-    qreal px = abs(0.5 - x) * 2.;
-    qreal py = abs(0.5 - y) * 2.;
+// Distance of a sample from the center of the crop along one axis, 0 is the center, 1 the edge
+static inline qreal centerDistance(qreal offset, qreal extent) {
+    qreal x = offset / extent;
+    return abs(0.5 - x) * 2.;
+}
+
+// Importance of a sample inside the crop, everything outside has options.outsideImportance
+static inline qreal importance(const CropOptions &options, qreal px, qreal py) {
     // Distance from edge
     qreal dx = qMax<qreal>(px - 1.0 + options.edgeRadius, 0);
     qreal dy = qMax<qreal>(py - 1.0 + options.edgeRadius, 0);
@@ -190,58 +265,111 @@ static inline qreal importance(const CropOptions &options, const QRectF &crop, q
     return s + d;
 }
 
-static QList<QRectF> generateCrops(const CropOptions &options, qreal width, qreal height) {
-    QList<QRectF> results;
-    int minDimension = qMin(width, height);
-    qreal cropWidth = options.cropWidth > 0 ? options.cropWidth : minDimension;
-    qreal cropHeight = options.cropHeight > 0 ? options.cropHeight : minDimension;
-    for (
-         qreal scale = options.maxScale;
-         scale >= options.minScale;
-         scale -= options.scaleStep
-         ) {
-        for (qreal y = 0; y + cropHeight * scale <= height; y += options.step) {
-            for (qreal x = 0; x + cropWidth * scale <= width; x += options.step) {
-                results.append({x, y, cropWidth * scale, cropHeight * scale});
+// The score of a crop is the sum of importance * features over all samples of the downsampled image.
+// The weighted features are folded into a single plane once, the outside of the crop contributes a
+// constant share of their total and the importance weights only depend on the position relative to
+// the crop - so they are computed once per crop size and reused while the crop moves over the image.
+class CropScorer {
+public:
+    CropScorer(const CropOptions &options, const QImage &output) : m_options(options) {
+        const qreal downSample = options.scoreDownSample;
+        const qreal invDownSample = 1. / downSample;
+        const qreal outputHeightDownSample = output.height() * downSample;
+        const qreal outputWidthDownSample = output.width() * downSample;
+
+        for (int y = 0; y < outputHeightDownSample; y += downSample) {
+            m_ys.append(y);
+        }
+        for (int x = 0; x < outputWidthDownSample; x += downSample) {
+            m_xs.append(x);
+        }
+
+        m_features.reserve(m_xs.size() * m_ys.size());
+        for (int y : m_ys) {
+            const uchar *od = output.scanLine(qFloor(y * invDownSample));
+            for (int x : m_xs) {
+                int p = (qFloor(x * invDownSample)) * 4;
+                qreal dtl = od[p + 1] / 255.;
+
+                qreal feature = dtl * options.detailWeight +
+                                (od[p] / 255.) * (dtl + options.skinBias) * options.skinWeight +
+                                (od[p + 2] / 255) * (dtl + options.saturationBias) * options.saturationWeight +
+                                (od[p + 3] / 255.) * options.boostWeight;
+                m_features.append(feature);
+                m_total += feature;
             }
         }
     }
-    return results;
-}
 
-static float score(const CropOptions &options, const QImage &output, const QRectF &crop) {
-    qreal detail = 0;
-    qreal saturation = 0;
-    qreal skin = 0;
-    qreal boost = 0;
+    float score(const QRectF &crop) {
+        int left, right, top, bottom;
+        axisRange(m_xs, crop.x(), crop.width(), left, right);
+        axisRange(m_ys, crop.y(), crop.height(), top, bottom);
+        const int columns = right - left;
+        const int rows = bottom - top;
+
+        // The weights only depend on where the first sample falls inside the crop and on its size.
+        // That repeats whenever the crop moves by a multiple of the sample distance, which with the
+        // default step is every candidate of a scale.
+        const qreal phaseX = columns ? m_xs.at(left) - crop.x() : 0;
+        const qreal phaseY = rows ? m_ys.at(top) - crop.y() : 0;
+        if (phaseX != m_phaseX || phaseY != m_phaseY || crop.size() != m_cropSize ||
+            columns != m_columns || rows != m_rows) {
+            m_phaseX = phaseX;
+            m_phaseY = phaseY;
+            m_cropSize = crop.size();
+            m_columns = columns;
+            m_rows = rows;
+            m_weights.resize(columns * rows);
+            qreal *weight = m_weights.data();
+            for (int j = top; j < bottom; ++j) {
+                const qreal py = centerDistance(m_ys.at(j) - crop.y(), crop.height());
+                for (int i = left; i < right; ++i) {
+                    *weight++ = importance(m_options, centerDistance(m_xs.at(i) - crop.x(), crop.width()), py) -
+                                m_options.outsideImportance;
+                }
+            }
+        }
+
+        qreal sum = m_total * m_options.outsideImportance;
+        const qreal *weight = m_weights.constData();
+        const int stride = m_xs.size();
+        for (int j = top; j < bottom; ++j) {
+            const qreal *feature = m_features.constData() + j * stride;
+            for (int i = left; i < right; ++i) {
+                sum += *weight++ * feature[i];
+            }
+        }
 
-    qreal downSample = options.scoreDownSample;
-    qreal invDownSample = 1. / downSample;
-    qreal outputHeightDownSample = output.height() * downSample;
-    qreal outputWidthDownSample = output.width() * downSample;
+        return sum / (crop.width() * crop.height());
+    }
 
-    for (int y = 0; y < outputHeightDownSample; y += downSample) {
-        const uchar *od = output.scanLine(qFloor(y * invDownSample));
-        for (int x = 0; x < outputWidthDownSample; x += downSample) {
-            int p = (qFloor(x * invDownSample)) * 4;
-            qreal i = importance(options, crop, x, y);
-            qreal dtl = od[p + 1] / 255.;
-
-            skin += (od[p] / 255.) * (dtl + options.skinBias) * i;
-            detail += dtl * i;
-            saturation +=
-                    (od[p + 2] / 255) * (dtl + options.saturationBias) * i;
-            boost += (od[p + 3] / 255.) * i;
+private:
+    // samples [first, last) are inside of the crop
+    static void axisRange(const QVector<int> &samples, qreal start, qreal extent, int &first, int &last) {
+        first = 0;
+        while (first < samples.size() && start > samples.at(first)) {
+            ++first;
+        }
+        last = first;
+        while (last < samples.size() && samples.at(last) < start + extent) {
+            ++last;
         }
     }
 
-    return
-            (detail * options.detailWeight +
-             skin * options.skinWeight +
-             saturation * options.saturationWeight +
-             boost * options.boostWeight) /
-            (crop.width() * crop.height());
-}
+    const CropOptions &m_options;
+    QVector<int> m_xs;
+    QVector<int> m_ys;
+    QVector<qreal> m_features;
+    qreal m_total = 0;
+    // what m_weights were computed for
+    qreal m_phaseX = -1;
+    qreal m_phaseY = -1;
+    QSizeF m_cropSize;
+    int m_columns = -1;
+    int m_rows = -1;
+    QVector<qreal> m_weights;
+};
 
 QRect smartCropRect(const QImage &input, CropOptions options)
 {
@@ -288,26 +416,37 @@ QRect smartCropRect(const QImage &input, CropOptions options)
     }
     image = image.convertToFormat(QImage::Format_RGBA8888);
 
-    QImage filtered = image.copy();
+    QImage filtered = detectFeatures(options, image);
     if (filtered.isNull()) {
-        qWarning() << "Failed to copy image!";
+        qWarning() << "Failed to allocate feature image!";
         return input.rect();
     }
 
-    edgeDetect(image, filtered);
-    skinDetect(options, image, filtered);
-    saturationDetect(options, image, filtered);
     QImage toScore = downSample(filtered, options.scoreDownSample);
+    CropScorer scorer(options, toScore);
 
-    QList<QRectF> crops = generateCrops(options, image.width(), image.height());
+    const qreal width = image.width();
+    const qreal height = image.height();
+    int minDimension = qMin(width, height);
+    qreal cropWidth = options.cropWidth > 0 ? options.cropWidth : minDimension;
+    qreal cropHeight = options.cropHeight > 0 ? options.cropHeight : minDimension;
 
     QRectF topCrop;
     qreal topScore = -1;
-    for (const QRectF &crop : crops) {
-        float scr = score(options, toScore, crop);
-        if (scr > topScore || topCrop.isEmpty()) {
-            topCrop = crop;
-            topScore = scr;
+    for (
+         qreal scale = options.maxScale;
+         scale >= options.minScale;
+         scale -= options.scaleStep
+         ) {
+        for (qreal y = 0; y + cropHeight * scale <= height; y += options.step) {
+            for (qreal x = 0; x + cropWidth * scale <= width; x += options.step) {
+                const QRectF crop(x, y, cropWidth * scale, cropHeight * scale);
+                float scr = scorer.score(crop);
+                if (scr > topScore || topCrop.isEmpty()) {
+                    topCrop = crop;
+                    topScore = scr;
+                }
+            }
         }
     }
 
@@ -16,7 +16,6 @@
  *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <QApplication>
 #include <QBoxLayout>
 #include <QInputDialog>
 #include <QHeaderView>
@@ -30,13 +29,11 @@
 
 #include "MessageBox.h"
 #include "MetadataCache.h"
-#include "ProgressDialog.h"
+#include "MetadataWriter.h"
 #include "Settings.h"
 #include "Tags.h"
 #include "ThumbsViewer.h"
 
-#include <exiv2/exiv2.hpp>
-
 ImageTags::ImageTags(QWidget *parent, ThumbsViewer *thumbsViewer) : QWidget(parent) {
     m_populated = false;
     tagsTree = new QTreeWidget;
@@ -150,67 +147,6 @@ void ImageTags::addTag(QString tagName, bool tagChecked) {
     tagsTree->addTopLevelItem(tagItem);
 }
 
-bool ImageTags::writeTagsToImage(QString &imageFileName, const QSet<QString> &newTags) {
-    QSet<QString> imageTags;
-
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wdeprecated-declarations"
-#if EXIV2_TEST_VERSION(0,28,0)
-    Exiv2::Image::UniquePtr exifImage;
-#else
-    Exiv2::Image::AutoPtr exifImage;
-#endif
-#pragma clang diagnostic pop
-
-    try {
-        exifImage = Exiv2::ImageFactory::open(imageFileName.toStdString());
-        exifImage->readMetadata();
-
-        Exiv2::IptcData newIptcData;
-
-        /* copy existing data */
-        Exiv2::IptcData &iptcData = exifImage->iptcData();
-        if (!iptcData.empty()) {
-            QString key;
-            Exiv2::IptcData::iterator end = iptcData.end();
-            for (Exiv2::IptcData::iterator iptcIt = iptcData.begin(); iptcIt != end; ++iptcIt) {
-                if (iptcIt->tagName() != "Keywords") {
-                    newIptcData.add(*iptcIt);
-                }
-            }
-        }
-
-        /* add new tags */
-        QSetIterator<QString> newTagsIt(newTags);
-        while (newTagsIt.hasNext()) {
-            QString tag = newTagsIt.next();
-
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wdeprecated-declarations"
-#if EXIV2_TEST_VERSION(0,28,0)
-            Exiv2::Value::UniquePtr value = Exiv2::Value::create(Exiv2::string);
-#else
-            Exiv2::Value::AutoPtr value = Exiv2::Value::create(Exiv2::string);
-#endif
-#pragma clang diagnostic pop
-
-            value->read(tag.toStdString());
-            Exiv2::IptcKey key("Iptc.Application2.Keywords");
-            newIptcData.add(key, value.get());
-        }
-
-        exifImage->setIptcData(newIptcData);
-        exifImage->writeMetadata();
-    }
-    catch (Exiv2::Error &error) {
-        MessageBox msgBox(this);
-        msgBox.critical(tr("Error"), tr("Failed to save tags to %1").arg(imageFileName));
-        return false;
-    }
-
-    return true;
-}
-
 void ImageTags::showSelectedImagesTags() {
     static bool busy = false;
     if (busy)
@@ -396,40 +332,28 @@ void ImageTags::applyUserAction(QTreeWidgetItem *item) {
 }
 
 void ImageTags::applyUserAction(QList<QTreeWidgetItem *> tagsList) {
-    ProgressDialog *progressDialog = new ProgressDialog(this);
-    progressDialog->show();
-
     QStringList currentSelectedImages = thumbView->getSelectedThumbsList();
+    for (int i = tagsList.size() - 1; i > -1; --i) {
+        Qt::CheckState tagState = tagsList.at(i)->checkState(0);
+        setTagIcon(tagsList.at(i), (tagState == Qt::Checked ? TagIconEnabled : TagIconDisabled));
+    }
+
+    // the cache has the new tags right away, the files get them in the background
     for (int currentImage = 0; currentImage < currentSelectedImages.size(); ++currentImage) {
 
         QString imageName = currentSelectedImages[currentImage];
         for (int i = tagsList.size() - 1; i > -1; --i) {
-            Qt::CheckState tagState = tagsList.at(i)->checkState(0);
-            setTagIcon(tagsList.at(i), (tagState == Qt::Checked ? TagIconEnabled : TagIconDisabled));
             QString tagName = tagsList.at(i)->text(0);
 
-            if (tagState == Qt::Checked) {
-                progressDialog->opLabel->setText(tr("Tagging %1").arg(imageName));
+            if (tagsList.at(i)->checkState(0) == Qt::Checked) {
                 Metadata::addTag(imageName, tagName);
             } else {
-                progressDialog->opLabel->setText(tr("Untagging %1").arg(imageName));
                 Metadata::removeTag(imageName, tagName);
             }
         }
 
-        if (!writeTagsToImage(imageName, Metadata::tags(imageName))) {
-            Metadata::forget(imageName);
-        }
-
-        QApplication::processEvents();
-
-        if (progressDialog->abortOp) {
-            break;
-        }
+        MetadataWriter::instance()->setTags(imageName, Metadata::tags(imageName), Settings::tagSidecars);
     }
-
-    progressDialog->close();
-    delete (progressDialog);
 }
 
 void ImageTags::saveLastChangedTag(QTreeWidgetItem *item, int) {
@@ -69,8 +69,6 @@ public:
     bool m_populated;
 
 private:
-    bool writeTagsToImage(QString &imageFileName, const QSet<QString> &tags);
-
     QSet<QString> getCheckedTags(Qt::CheckState tagState);
 
     void setTagIcon(QTreeWidgetItem *tagItem, TagIcons icon);
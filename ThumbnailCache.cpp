@@ -0,0 +1,356 @@
+/*
+ *  Copyright (C) 2013-2015 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QColorSpace>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QMimeDatabase>
+#include <QStandardPaths>
+#include <QThread>
+#include <QUrl>
+#include "ThumbnailCache.h"
+
+namespace ThumbnailCache {
+
+QString fileName(const QString &originalPath)
+{
+    QFileInfo info(originalPath);
+    QString canonicalPath = info.canonicalFilePath();
+    if (canonicalPath.isEmpty()) {
+        qWarning() << originalPath << "does not exist!";
+        canonicalPath = info.absoluteFilePath();
+    }
+    QUrl url = QUrl::fromLocalFile(canonicalPath);
+    QCryptographicHash md5(QCryptographicHash::Md5);
+    md5.addData(QFile::encodeName(url.adjusted(QUrl::RemovePassword).url()));
+    return QString::fromLatin1(md5.result().toHex()) + QStringLiteral(".png");
+}
+
+QString locate(const QString &originalPath, int thumbSize)
+{
+#if defined(Q_OS_MAC) || defined(Q_OS_WIN)
+    return "";
+#endif
+    const QString basePath = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) +
+                                                                        QLatin1String("/thumbnails/");
+    if (originalPath.startsWith(basePath))
+        return QString(); // we're in the thumbnail cache, no point in checking stuff
+
+    QStringList folders = {
+        QStringLiteral("xx-large/"), // max 1024px
+        QStringLiteral("x-large/"), // max 512px
+        QStringLiteral("large/"), // max 256px, doesn't look too bad when upscaled to max
+    };
+
+    if (thumbSize <= 200) {
+        folders.append(QStringLiteral("normal/")); // 128px max
+    }
+    const QString filename = fileName(originalPath);
+    const QFileInfo originalInfo(originalPath);
+    for (const QString &folder : folders) {
+        QFileInfo info(basePath + folder + filename);
+        if (!info.exists()) {
+            continue;
+        }
+        if (originalInfo.metadataChangeTime() > info.lastModified()) {
+            continue;
+        }
+        if (originalInfo.lastModified() > info.lastModified()) {
+            continue;
+        }
+        return info.absoluteFilePath();
+    }
+    return QString();
+}
+
+void store(const QString &originalPath, QImage thumbnail, const QSize &originalSize) {
+#if defined(Q_OS_MAC) || defined(Q_OS_WIN)
+    return;
+#endif
+    const QString canonicalPath = QFileInfo(originalPath).canonicalFilePath();
+    if (canonicalPath.isEmpty()) {
+        qWarning() << "Asked to store thumbnail for non-existent path" << originalPath;
+        return;
+    }
+
+    QString folder = QStringLiteral("normal/");
+    const int maxSize = qMax(thumbnail.width(), thumbnail.height());
+    if (maxSize < 64) {
+        qDebug() << "Refusing to store tiny thumbnail" << thumbnail.size();
+        return;
+    }
+    if (maxSize >= 1024) {
+        folder = QStringLiteral("xx-large/");
+        thumbnail = thumbnail.scaled(1024, 1024, Qt::KeepAspectRatio);
+    } else if (maxSize >= 384) {
+        folder = QStringLiteral("x-large/");
+        thumbnail = thumbnail.scaled(512, 512, Qt::KeepAspectRatio);
+    } else if (maxSize > 200) {
+        folder = QStringLiteral("large/");
+        thumbnail = thumbnail.scaled(256, 256, Qt::KeepAspectRatio);
+    } else if (maxSize >= 100) {
+        folder = QStringLiteral("normal/");
+        thumbnail = thumbnail.scaled(128, 128, Qt::KeepAspectRatio);
+    } else {
+        qWarning() << "Thumbnail too small" << thumbnail.size();
+        return;
+    }
+
+    const QString filename = fileName(originalPath);
+    const QString basePath = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) +
+        QLatin1String("/thumbnails/");
+
+    if (!QFileInfo::exists(basePath + folder)) {
+        QDir().mkpath(basePath + folder);
+    }
+
+    const QString fullPath = basePath + folder + filename;
+    QFileInfo info(fullPath);
+
+    QDateTime lastModified = info.lastModified();
+    if (info.metadataChangeTime() > info.lastModified()) {
+        lastModified = info.metadataChangeTime();
+    }
+    thumbnail.setText(QStringLiteral("Thumb::MTime"), QString::number(lastModified.toSecsSinceEpoch()));
+
+    QUrl url = QUrl::fromLocalFile(canonicalPath).adjusted(QUrl::RemovePassword);
+    thumbnail.setText(QStringLiteral("Thumb::URI"), url.url());
+
+    thumbnail.setText(QStringLiteral("Thumb::Image::Width"), QString::number(originalSize.width()));
+    thumbnail.setText(QStringLiteral("Thumb::Image::Height"), QString::number(originalSize.height()));
+    thumbnail.setText("Software", "Phototonic");
+    thumbnail.convertToColorSpace(QColorSpace::SRgb);
+
+    thumbnail.save(fullPath);
+}
+
+bool warm(const QString &imagePath, QString *error, QSemaphore *readers) {
+    const QSize originalSize = QImageReader(imagePath).size();
+    // the viewer doesn't store thumbnails for these either, they decode fast enough
+    if (originalSize.isValid() && qMax(originalSize.width(), originalSize.height()) <= 1024) {
+        return true;
+    }
+    if (!locate(imagePath, 256).isEmpty()) {
+        return true;
+    }
+
+    QImageReader reader;
+    QByteArray data;
+    QBuffer buffer(&data);
+    if (readers) {
+        // read in one go, so decoding doesn't compete with other readers for the disk
+        QFile file(imagePath);
+        readers->acquire();
+        const bool opened = file.open(QIODevice::ReadOnly);
+        if (opened) {
+            data = file.readAll();
+        }
+        readers->release();
+        if (!opened) {
+            if (error) {
+                *error = file.errorString();
+            }
+            return false;
+        }
+        buffer.open(QIODevice::ReadOnly);
+        reader.setDevice(&buffer);
+    } else {
+        reader.setFileName(imagePath);
+    }
+    reader.setQuality(50); // 50 is the threshold where Qt does fast decoding, but still good scaling
+
+    // large enough for every thumbnail zoom level
+    if (originalSize.isValid()) {
+        reader.setScaledSize(originalSize.scaled(512, 512, Qt::KeepAspectRatio));
+    }
+    QImage thumbnail;
+    if (!reader.read(&thumbnail)) {
+        if (error) {
+            *error = reader.errorString();
+        }
+        return false;
+    }
+    store(imagePath, thumbnail, originalSize);
+    return true;
+}
+
+QStringList imageTypeGlobs() {
+    QStringList globs;
+    QMimeDatabase db;
+    for (const QByteArray &type : QImageReader::supportedMimeTypes()) {
+        globs.append(db.mimeTypeForName(type).globPatterns());
+    }
+    return globs;
+}
+
+QBitArray differenceHash(const QString &imagePath, int thumbSize, bool *ok) {
+    QImageReader imageReader;
+    QImage image;
+    imageReader.setFileName(imagePath);
+    imageReader.setQuality(50); // 50 is the threshold where Qt does fast decoding, but still good scaling
+    const QSize targetSize = imageReader.size();
+    QSize realSize;
+    QString thumbnailPath = locate(imagePath, thumbSize);
+    if (!thumbnailPath.isEmpty() && QImageReader(thumbnailPath).canRead()) {
+        imageReader.setFileName(thumbnailPath);
+        imageReader.read(&image);
+        realSize = QSize(image.text("Thumb::Image::Width").toInt(), image.text("Thumb::Image::Height").toInt());
+    }
+    if (targetSize != realSize) {
+        imageReader.setFileName(imagePath);
+        imageReader.read(&image);
+    }
+
+    *ok = !image.isNull();
+    if (!*ok) {
+        return QBitArray();
+    }
+
+    QBitArray imageHash(64);
+    image = image.convertToFormat(QImage::Format_Grayscale8).scaled(9, 9, Qt::KeepAspectRatioByExpanding /*, Qt::SmoothTransformation*/);
+    for (int y=0; y<8; ++y) {
+        const uchar *line = image.scanLine(y);
+        //const uchar *nextLine = image.scanLine(y+1);
+        for (int x=0; x<8; ++x) {
+            imageHash.setBit(y * 8 + x, line[x] > line[x+1]);
+            //imageHash.setBit(y * 8 + x + 64, line[x] > nextLine[x]);
+        }
+    }
+    return imageHash;
+}
+
+} // namespace ThumbnailCache
+
+ThumbnailWarmer::ThumbnailWarmer(int threads, int readers, bool lowPriority, QObject *parent)
+    : QObject(parent), m_threadCount(qMax(1, threads)), m_lowPriority(lowPriority), m_readers(qMax(1, readers))
+{
+}
+
+ThumbnailWarmer::~ThumbnailWarmer() {
+    cancel();
+    for (QThread *thread : m_threads) {
+        thread->wait();
+        delete thread;
+    }
+}
+
+void ThumbnailWarmer::start(const QStringList &paths) {
+    const QThread::Priority priority = m_lowPriority ? QThread::IdlePriority : QThread::LowPriority;
+    m_mutex.lock();
+    m_crawling = true;
+    m_running = m_threadCount + 1;
+    m_mutex.unlock();
+
+    QThread *crawler = QThread::create([=]() { crawl(paths); });
+    crawler->start(priority);
+    m_threads << crawler;
+    for (int i = 0; i < m_threadCount; ++i) {
+        QThread *worker = QThread::create([=]() { work(); });
+        worker->start(priority);
+        m_threads << worker;
+    }
+}
+
+void ThumbnailWarmer::cancel() {
+    QMutexLocker locker(&m_mutex);
+    m_cancel.storeRelaxed(1);
+    m_jobs.clear();
+    m_wake.wakeAll();
+}
+
+bool ThumbnailWarmer::wait(unsigned long msecs) {
+    for (QThread *thread : m_threads) {
+        if (!thread->wait(msecs)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ThumbnailWarmer::crawl(const QStringList &paths) {
+    const QStringList globs = ThumbnailCache::imageTypeGlobs();
+    QStringList batch;
+    auto flush = [&]() {
+        QMutexLocker locker(&m_mutex);
+        m_jobs << batch;
+        m_total += batch.count();
+        batch.clear();
+        m_wake.wakeAll();
+    };
+
+    for (const QString &path : paths) {
+        const QFileInfo info(path);
+        if (!info.isDir()) {
+            batch << info.absoluteFilePath();
+            continue;
+        }
+        QDirIterator it(info.absoluteFilePath(), globs, QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext() && !m_cancel.loadRelaxed()) {
+            batch << it.next();
+            if (batch.count() == 64) {
+                flush();
+            }
+        }
+    }
+    flush();
+
+    m_mutex.lock();
+    m_crawling = false;
+    m_wake.wakeAll();
+    const bool last = --m_running == 0;
+    m_mutex.unlock();
+    if (last) {
+        emit finished();
+    }
+}
+
+void ThumbnailWarmer::work() {
+    forever {
+        m_mutex.lock();
+        while (m_jobs.isEmpty() && m_crawling && !m_cancel.loadRelaxed()) {
+            m_wake.wait(&m_mutex);
+        }
+        if (m_jobs.isEmpty() || m_cancel.loadRelaxed()) {
+            const bool last = --m_running == 0;
+            m_mutex.unlock();
+            if (last) {
+                emit finished();
+            }
+            return;
+        }
+        const QString imagePath = m_jobs.takeFirst();
+        m_mutex.unlock();
+
+        QString error;
+        if (!ThumbnailCache::warm(imagePath, &error, &m_readers)) {
+            m_failed.ref();
+            emit failed(imagePath, error);
+        }
+
+        m_mutex.lock();
+        const int done = ++m_done;
+        const int total = m_total;
+        m_mutex.unlock();
+        emit progress(done, total, imagePath);
+    }
+}
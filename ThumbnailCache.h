@@ -0,0 +1,86 @@
+/*
+ *  Copyright (C) 2013-2015 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THUMBNAIL_CACHE_H
+#define THUMBNAIL_CACHE_H
+
+class QThread;
+#include <QAtomicInt>
+#include <QBitArray>
+#include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QSemaphore>
+#include <QStringList>
+#include <QWaitCondition>
+
+// The freedesktop.org thumbnail cache, nothing in here needs a GUI and all of it is threadsafe
+namespace ThumbnailCache {
+    QString fileName(const QString &originalPath);
+    // the cached thumbnail of originalPath that serves thumbSize or an empty string
+    QString locate(const QString &originalPath, int thumbSize);
+    void store(const QString &originalPath, QImage thumbnail, const QSize &originalSize);
+    // cache a thumbnail unless there is one or the image is small enough to not need one,
+    // reading the file only while holding one of readers
+    bool warm(const QString &imagePath, QString *error = nullptr, QSemaphore *readers = nullptr);
+    // 64 bit gradient hash for finding duplicates, from the cached thumbnail where possible
+    QBitArray differenceHash(const QString &imagePath, int thumbSize, bool *ok);
+    // the file name patterns of all readable image types
+    QStringList imageTypeGlobs();
+};
+
+// Crawls directory trees and caches the thumbnails missing there on worker threads
+class ThumbnailWarmer : public QObject {
+Q_OBJECT
+
+public:
+    // threads decode at once, readers of them read files at once
+    ThumbnailWarmer(int threads, int readers, bool lowPriority, QObject *parent = nullptr);
+    ~ThumbnailWarmer();
+    // image files, or directories to crawl
+    void start(const QStringList &paths);
+    void cancel();
+    // true once all threads are done
+    bool wait(unsigned long msecs);
+    int failedCount() const { return m_failed.loadRelaxed(); }
+
+signals:
+    void progress(int done, int total, const QString &imagePath);
+    void failed(const QString &imagePath, const QString &error);
+    void finished();
+
+private:
+    void crawl(const QStringList &paths);
+    void work();
+
+    const int m_threadCount;
+    const bool m_lowPriority;
+    QSemaphore m_readers;
+    QMutex m_mutex;
+    QWaitCondition m_wake;
+    QStringList m_jobs;
+    bool m_crawling = false;
+    int m_total = 0;
+    int m_done = 0;
+    int m_running = 0;
+    QAtomicInt m_failed;
+    QAtomicInt m_cancel;
+    QList<QThread*> m_threads;
+};
+
+#endif // THUMBNAIL_CACHE_H
@@ -18,34 +18,38 @@
 
 #include <QApplication>
 #include <QCollator>
-#include <QColorSpace>
 #include <QDirIterator>
-#include <QCryptographicHash>
 #include <QDrag>
 #include <QImageReader>
 #include <QLabel>
 #include <QMimeData>
 #include <QMimeDatabase>
 #include <QMouseEvent>
+#include <QMutex>
 #include <QPainter>
 #include <QPen>
 #include <QProgressDialog>
 #include <QScrollBar>
 #include <QStandardItemModel>
-#include <QStandardPaths>
 #include <QThread>
 #include <QTimer>
 #include <QTreeWidget>
+#include <QWaitCondition>
 #include <cmath>
 
+#include "DirectoryWatcher.h"
 #include "MetadataCache.h"
 #include "Settings.h"
 #include "SmartCrop.h"
 #include "Tags.h"
+#include "ThumbnailCache.h"
 #include "ThumbsViewer.h"
 
 #define BATCH_SIZE 10
 
+// for the decoded thumbnails kept with the items, those furthest from the view are dropped first
+static const qint64 gs_thumbCacheBudget = 256 * 1024 * 1024;
+
 ThumbsViewer::ThumbsViewer(QWidget *parent) : QListView(parent) {
     m_busy = false;
     Settings::thumbsBackgroundColor = Settings::value(Settings::optionThumbsBackgroundColor).value<QColor>();
@@ -71,6 +75,46 @@ ThumbsViewer::ThumbsViewer(QWidget *parent) : QListView(parent) {
     m_model->setSortRole(SortRole);
     setModel(m_model);
 
+    // Keep the path index in step with every change of the model, whoever makes it. Rows appended or removed
+    // at the end are indexed as they come and go, anything that moves rows has it rebuilt in one pass when needed.
+    connect(m_model, &QAbstractItemModel::rowsInserted, this, [=](const QModelIndex &, int first, int last) {
+        if (last == m_model->rowCount() - 1 && !m_rowIndexDirty) {
+            for (int row = first; row <= last; ++row) {
+                m_rowIndex.insert(m_model->item(row)->data(FileNameRole).toString(), row);
+            }
+        } else {
+            m_rowIndexDirty = true;
+        }
+    });
+    connect(m_model, &QAbstractItemModel::rowsAboutToBeRemoved, this, [=](const QModelIndex &, int first, int last) {
+        if (last == m_model->rowCount() - 1 && !m_rowIndexDirty) {
+            for (int row = first; row <= last; ++row) {
+                m_rowIndex.remove(m_model->item(row)->data(FileNameRole).toString());
+            }
+        } else {
+            m_rowIndexDirty = true;
+        }
+        for (int row = first; row <= last; ++row) {
+            m_thumbCacheBytes -= m_model->item(row)->data(ThumbImageRole).value<QImage>().sizeInBytes();
+        }
+    });
+    connect(m_model, &QAbstractItemModel::layoutChanged, this, [=]() {
+        m_rowIndexDirty = true;
+    });
+    connect(m_model, &QAbstractItemModel::dataChanged, this,
+            [=](const QModelIndex &, const QModelIndex &, const QList<int> &roles) {
+        if (roles.isEmpty() || roles.contains(FileNameRole)) {
+            m_rowIndexDirty = true;
+        }
+    });
+    connect(m_model, &QAbstractItemModel::modelReset, this, [=]() {
+        m_rowIndexDirty = true;
+        m_thumbCacheBytes = 0;
+        for (int row = 0; row < m_model->rowCount(); ++row) {
+            m_thumbCacheBytes += m_model->item(row)->data(ThumbImageRole).value<QImage>().sizeInBytes();
+        }
+    });
+
     m_selectionChangedTimer.setInterval(10);
     m_selectionChangedTimer.setSingleShot(true);
     connect(&m_selectionChangedTimer, &QTimer::timeout, this, &ThumbsViewer::onSelectionChanged);
@@ -84,6 +128,60 @@ ThumbsViewer::ThumbsViewer(QWidget *parent) : QListView(parent) {
     m_loadThumbTimer.setSingleShot(true);
     connect(&m_loadThumbTimer, &QTimer::timeout, [=](){ loadVisibleThumbs(verticalScrollBar()->value()); });
 
+    // changes on disk are applied row by row, writers tend to come in bursts so collect them for a moment
+    m_watcher = new DirectoryWatcher(this);
+    m_directoryChangedTimer.setInterval(250);
+    m_directoryChangedTimer.setSingleShot(true);
+    connect(m_watcher, &DirectoryWatcher::directoryChanged, this, [=](const QString &path) {
+        m_changedDirectories.insert(path);
+        m_directoryChangedTimer.start();
+    });
+    connect(m_watcher, &DirectoryWatcher::fileChanged, this, [=](const QString &path) {
+        m_changedFiles.insert(path);
+        m_directoryChangedTimer.start();
+    });
+    connect(m_watcher, &DirectoryWatcher::directoryAdded, this, [=](const QString &path) {
+        // with subdirectories listed, a new one and whatever it brought along gets listed and watched as well,
+        // symlinks aren't followed just like when crawling
+        if (!Settings::includeSubDirectories || Settings::isFileListLoaded || QFileInfo(path).isSymLink()) {
+            return;
+        }
+        QDir::Filters dirFilters = QDir::Dirs | QDir::NoDotAndDotDot;
+        if (Settings::showHiddenFiles) {
+            dirFilters |= QDir::Hidden;
+        }
+        QStringList directories(path);
+        QDirIterator it(path, dirFilters, QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            it.next();
+            const QFileInfo directory = it.fileInfo();
+            if (!directory.isSymLink()) {
+                directories.append(directory.filePath());
+            }
+        }
+        m_watcher->addDirectories(directories);
+        for (const QString &directory : std::as_const(directories)) {
+            m_changedDirectories.insert(directory);
+        }
+        m_directoryChangedTimer.start();
+    });
+    connect(&m_directoryChangedTimer, &QTimer::timeout, [=]() {
+        if (m_busy) {
+            m_directoryChangedTimer.start();
+            return;
+        }
+        const QSet<QString> changedDirectories = m_changedDirectories;
+        const QSet<QString> changedFiles = m_changedFiles;
+        m_changedDirectories.clear();
+        m_changedFiles.clear();
+        for (const QString &path : changedDirectories) {
+            updateDirectory(path);
+        }
+        if (!changedFiles.isEmpty()) {
+            updateFiles(changedFiles);
+        }
+    });
+
     emptyImg.load(":/images/no_image.png");
 }
 
@@ -140,14 +238,30 @@ bool ThumbsViewer::setCurrentIndex(const QString &fileName) {
         m_desiredThumbPath = fileName;
         return true;
     }
-    QModelIndexList indexList = m_model->match(m_model->index(0, 0), FileNameRole, fileName);
-    if (indexList.size()) {
-        setCurrentIndex(indexList.at(0));
+    const int row = rowOf(fileName);
+    if (row > -1) {
+        setCurrentIndex(m_model->index(row, 0));
         return true;
     }
     return false;
 }
 
+int ThumbsViewer::rowOf(const QString &imageFullPath) const {
+    return rowIndex().value(imageFullPath, -1);
+}
+
+const QHash<QString, int> &ThumbsViewer::rowIndex() const {
+    if (m_rowIndexDirty) {
+        m_rowIndex.clear();
+        m_rowIndex.reserve(m_model->rowCount());
+        for (int row = 0; row < m_model->rowCount(); ++row) {
+            m_rowIndex.insert(m_model->item(row)->data(FileNameRole).toString(), row);
+        }
+        m_rowIndexDirty = false;
+    }
+    return m_rowIndex;
+}
+
 bool ThumbsViewer::setCurrentIndex(int row) {
     QModelIndex idx = m_model->indexFromItem(m_model->item(row));
     if (idx.isValid()) {
@@ -383,7 +497,20 @@ void ThumbsViewer::reLoad() {
     histograms.clear();
     m_histSorted = false;
 
-    loadPrepare();
+    // Reloading the listed directory only applies the difference, rows that are still wanted keep
+    // their decoded thumbnails. Whatever doesn't get claimed again by appendThumbs() is removed at the end.
+    const bool keepRows = !Settings::isFileListLoaded && m_listedDirectory == Settings::currentDirectory;
+    m_staleItems.clear();
+    if (keepRows) {
+        // the path index has them all, without a persistent index per row for the model to maintain
+        const QHash<QString, int> &index = rowIndex();
+        for (QHash<QString, int>::const_iterator it = index.cbegin(); it != index.cend(); ++it) {
+            m_staleItems.insert(it.key());
+        }
+    }
+    m_relayoutKeptRows = m_listedThumbsLayout != Settings::thumbsLayout;
+
+    loadPrepare(keepRows);
 
     if (Settings::isFileListLoaded) {
         loadFileList();
@@ -395,38 +522,195 @@ void ThumbsViewer::reLoad() {
     initThumbs();
     updateThumbsCount();
     loadVisibleThumbs();
+    m_watcher->addDirectories(QStringList(Settings::currentDirectory));
 
     if (Settings::includeSubDirectories) {
         loadSubDirectories();
     }
 
+    if (!isAbortThumbsLoading) {
+        removeStaleThumbs();
+        m_listedDirectory = Settings::currentDirectory;
+        m_listedThumbsLayout = Settings::thumbsLayout;
+    }
+    m_staleItems.clear();
+
     m_busy = false;
     connect(verticalScrollBar(), SIGNAL(valueChanged(int)), scrollDelay, SLOT(start()));
 }
 
-void ThumbsViewer::loadSubDirectories() {
-    QDirIterator dirIterator(Settings::currentDirectory, QDirIterator::Subdirectories);
+static void sortByName(QFileInfoList &fileInfoList, QDir::SortFlags sortFlags) {
+    // QDir already sorted by time, size or type
+    if ((sortFlags & QDir::Time) || (sortFlags & QDir::Size) || (sortFlags & QDir::Type)) {
+        return;
+    }
 
-    int processed = 0;
-    while (dirIterator.hasNext()) {
-        dirIterator.next();
-        if (dirIterator.fileInfo().isDir() && dirIterator.fileName() != "." && dirIterator.fileName() != "..") {
-            thumbsDir.setPath(dirIterator.filePath());
+    QCollator collator;
+    if (sortFlags & QDir::IgnoreCase) {
+        collator.setCaseSensitivity(Qt::CaseInsensitive);
+    }
 
-            initThumbs();
-            updateThumbsCount();
-            loadVisibleThumbs();
+    collator.setNumericMode(true);
 
-            if (isAbortThumbsLoading) {
-                return;
+    if (sortFlags & QDir::Reversed) {
+        std::sort(fileInfoList.begin(), fileInfoList.end(), [&](const QFileInfo &a, const QFileInfo &b) {
+                return collator.compare(a.fileName(), b.fileName()) > 0;
+                });
+    } else {
+        std::sort(fileInfoList.begin(), fileInfoList.end(), [&](const QFileInfo &a, const QFileInfo &b) {
+                return collator.compare(a.fileName(), b.fileName()) < 0;
+                });
+    }
+}
+
+// Shared state of the recursive crawl. Idle workers take the next directory from the pending stack,
+// queue its subdirectories and hand the sorted files (with their metadata cached) back to the GUI thread
+struct DirectoryCrawl {
+    QMutex mutex;
+    QWaitCondition wake;
+    QWaitCondition resultsReady;
+    QString root;
+    // below root as it was given, so the rows have the same paths as those of root itself
+    QStringList pending;
+    QSet<QString> visited; // canonical paths, bind mounts and the like must not send us in circles
+    QList<QPair<QString, QFileInfoList>> results;
+    int busyWorkers = 0;
+    int runningWorkers = 0;
+    QAtomicInt abort;
+};
+
+static void crawlDirectories(DirectoryCrawl &crawl, QDir filesDir, QDir::Filters dirFilters, QDir::SortFlags sortFlags) {
+    forever {
+        QString path;
+        crawl.mutex.lock();
+        while (crawl.pending.isEmpty() && crawl.busyWorkers > 0 && !crawl.abort.loadRelaxed()) {
+            crawl.wake.wait(&crawl.mutex);
+        }
+        if (crawl.pending.isEmpty() || crawl.abort.loadRelaxed()) {
+            --crawl.runningWorkers;
+            crawl.wake.wakeAll();
+            crawl.resultsReady.wakeAll();
+            crawl.mutex.unlock();
+            return;
+        }
+        // depth first keeps the pending stack short
+        path = crawl.pending.takeLast();
+        ++crawl.busyWorkers;
+        crawl.mutex.unlock();
+
+        // like QDirIterator without FollowSymlinks: the files of a symlinked directory are listed,
+        // but the crawl doesn't descend into it
+        QList<QPair<QString, QString>> subDirectories;
+        if (path == crawl.root || !QFileInfo(path).isSymLink()) {
+            const QFileInfoList dirInfoList = QDir(path).entryInfoList(dirFilters);
+            for (const QFileInfo &dirInfo : dirInfoList) {
+                subDirectories.append(qMakePair(dirInfo.filePath(), dirInfo.canonicalFilePath()));
             }
         }
-        if (++processed > BATCH_SIZE) {
-            QApplication::processEvents();
-            processed = 0;
+
+        QFileInfoList fileInfoList;
+        if (path != crawl.root) { // the GUI thread has loaded that one already
+            filesDir.setPath(path);
+            fileInfoList = filesDir.entryInfoList();
+            sortByName(fileInfoList, sortFlags);
+            for (const QFileInfo &fileInfo : fileInfoList) {
+                if (crawl.abort.loadRelaxed()) {
+                    break;
+                }
+                Metadata::prefetch(fileInfo.filePath());
+            }
+        }
+
+        crawl.mutex.lock();
+        for (const QPair<QString, QString> &subDirectory : subDirectories) {
+            if (!subDirectory.second.isEmpty() && !crawl.visited.contains(subDirectory.second)) {
+                crawl.visited.insert(subDirectory.second);
+                crawl.pending.append(subDirectory.first);
+            }
+        }
+        if (path != crawl.root) {
+            crawl.results.append(qMakePair(path, fileInfoList));
+            crawl.resultsReady.wakeAll();
+        }
+        --crawl.busyWorkers;
+        crawl.wake.wakeAll();
+        crawl.mutex.unlock();
+    }
+}
+
+void ThumbsViewer::loadSubDirectories() {
+    DirectoryCrawl crawl;
+    const QString canonicalRoot = QFileInfo(Settings::currentDirectory).canonicalFilePath();
+    if (canonicalRoot.isEmpty()) {
+        return;
+    }
+    crawl.root = Settings::currentDirectory;
+    crawl.pending.append(crawl.root);
+    crawl.visited.insert(canonicalRoot);
+
+    QDir::Filters dirFilters = QDir::Dirs | QDir::NoDotAndDotDot;
+    if (Settings::showHiddenFiles) {
+        dirFilters |= QDir::Hidden;
+    }
+
+    // directory enumeration and metadata reading are bound by I/O latency, not by cores
+    const int workerCount = qBound(2, QThread::idealThreadCount(), 8);
+    QList<QThread*> workers;
+    crawl.runningWorkers = workerCount;
+    for (int i = 0; i < workerCount; ++i) {
+        QDir filesDir(thumbsDir);
+        QDir::SortFlags sortFlags = thumbsSortFlags;
+        QThread *worker = QThread::create([&crawl, filesDir, dirFilters, sortFlags]() {
+            crawlDirectories(crawl, filesDir, dirFilters, sortFlags);
+        });
+        worker->start(QThread::LowPriority);
+        workers.append(worker);
+    }
+
+    bool done = false;
+    while (!done) {
+        QList<QPair<QString, QFileInfoList>> batch;
+        crawl.mutex.lock();
+        if (crawl.results.isEmpty() && crawl.runningWorkers > 0) {
+            crawl.resultsReady.wait(&crawl.mutex, 30);
+        }
+        batch.swap(crawl.results);
+        done = crawl.runningWorkers == 0;
+        crawl.mutex.unlock();
+
+        if (!batch.isEmpty() && !isAbortThumbsLoading) {
+            QStringList directories;
+            for (const QPair<QString, QFileInfoList> &directory : batch) {
+                directories.append(directory.first);
+                // this also brings the prefetched tags into Settings::knownTags
+                appendThumbs(directory.second);
+            }
+            m_watcher->addDirectories(directories);
+            updateThumbsCount();
+            loadVisibleThumbs();
+        }
+        QApplication::processEvents();
+
+        if (isAbortThumbsLoading && !crawl.abort.loadRelaxed()) {
+            crawl.mutex.lock();
+            crawl.abort.storeRelaxed(1);
+            crawl.wake.wakeAll();
+            crawl.mutex.unlock();
         }
     }
 
+    for (QThread *worker : workers) {
+        worker->wait();
+        delete worker;
+    }
+
+    if (isAbortThumbsLoading) {
+        return;
+    }
+
+    if (imageTags->isVisible())
+        QTimer::singleShot(500, this, [=]() { if (imageTags->isVisible()) imageTags->populateTagsTree(); });
+
     onSelectionChanged();
 }
 
@@ -614,9 +898,16 @@ QSize ThumbsViewer::itemSizeHint() const
 }
 
 
-void ThumbsViewer::loadPrepare() {
+void ThumbsViewer::loadPrepare(bool keepRows) {
 
-    m_model->clear();
+    if (!keepRows) {
+        m_model->clear();
+        m_listedDirectory.clear();
+    }
+    m_watcher->clear();
+    m_changedDirectories.clear();
+    m_changedFiles.clear();
+    m_directoryChangedTimer.stop();
     gs_fontHeight = QFontMetrics(font()).height();
     setIconSize(QSize(thumbSize, thumbSize));
     setViewportMargins(0, gs_fontHeight, 0, 0);
@@ -700,36 +991,22 @@ finish:
     return;
 }
 
-void ThumbsViewer::initThumbs() {
-    thumbFileInfoList = thumbsDir.entryInfoList();
-
-    if (!(thumbsSortFlags & QDir::Time) && !(thumbsSortFlags & QDir::Size) && !(thumbsSortFlags & QDir::Type)) {
-        QCollator collator;
-        if (thumbsSortFlags & QDir::IgnoreCase) {
-            collator.setCaseSensitivity(Qt::CaseInsensitive);
-        }
-
-        collator.setNumericMode(true);
-
-        if (thumbsSortFlags & QDir::Reversed) {
-            std::sort(thumbFileInfoList.begin(), thumbFileInfoList.end(), [&](const QFileInfo &a, const QFileInfo &b) {
-                    return collator.compare(a.fileName(), b.fileName()) > 0;
-                    });
-        } else {
-            std::sort(thumbFileInfoList.begin(), thumbFileInfoList.end(), [&](const QFileInfo &a, const QFileInfo &b) {
-                    return collator.compare(a.fileName(), b.fileName()) < 0;
-                    });
-        }
-    }
-
+void ThumbsViewer::appendThumbs(const QFileInfoList &fileInfoList) {
     QSize hintSize = itemSizeHint();
 
     QElapsedTimer timer;
     timer.start();
 //    int totalTime = 0;
 
-    for (int fileIndex = 0; fileIndex < thumbFileInfoList.size(); ++fileIndex) {
-        thumbFileInfo = thumbFileInfoList.at(fileIndex);
+    for (int fileIndex = 0; fileIndex < fileInfoList.size(); ++fileIndex) {
+        thumbFileInfo = fileInfoList.at(fileIndex);
+
+        QStandardItem *staleItem = m_staleItems.contains(thumbFileInfo.filePath())
+                                 ? m_model->item(rowOf(thumbFileInfo.filePath())) : nullptr;
+        if (staleItem && (thumbFileInfo.lastModified() != staleItem->data(TimeRole).toDateTime() ||
+                          thumbFileInfo.size() != staleItem->data(SizeRole).toLongLong())) {
+            invalidateThumb(staleItem, thumbFileInfo);
+        }
 
         Metadata::cache(thumbFileInfo.filePath());
         if (imageTags->dirFilteringActive && imageTags->isImageFilteredOut(thumbFileInfo.filePath())) {
@@ -763,6 +1040,18 @@ void ThumbsViewer::initThumbs() {
         if (constrained)
             continue;
 
+        if (staleItem) {
+            m_staleItems.remove(thumbFileInfo.filePath());
+            staleItem->setData(fileIndex, SortRole);
+            if (m_relayoutKeptRows) {
+                staleItem->setSizeHint(hintSize);
+                staleItem->setTextAlignment(Qt::AlignTop | Qt::AlignHCenter);
+                staleItem->setText(Settings::thumbsLayout != Squares ? thumbFileInfo.fileName() : QString());
+                staleItem->setData(false, LoadedRole);
+            }
+            continue;
+        }
+
         QStandardItem *thumbItem = new QStandardItem();
         thumbItem->setData(false, LoadedRole);
         thumbItem->setData(fileIndex, SortRole);
@@ -791,6 +1080,12 @@ void ThumbsViewer::initThumbs() {
             timer.restart();
         }
     }
+}
+
+void ThumbsViewer::initThumbs() {
+    thumbFileInfoList = thumbsDir.entryInfoList();
+    sortByName(thumbFileInfoList, thumbsSortFlags);
+    appendThumbs(thumbFileInfoList);
 
     if (imageTags->isVisible())
         QTimer::singleShot(500, this, [=]() { if (imageTags->isVisible()) imageTags->populateTagsTree(); });
@@ -804,6 +1099,150 @@ void ThumbsViewer::initThumbs() {
     }
 }
 
+void ThumbsViewer::removeStaleThumbs() {
+    QList<int> rows;
+    for (const QString &path : std::as_const(m_staleItems)) {
+        const int row = rowOf(path);
+        if (row > -1) {
+            rows.append(row);
+        }
+    }
+    removeThumbRows(rows);
+}
+
+void ThumbsViewer::removeThumbRows(QList<int> rows) {
+    std::sort(rows.begin(), rows.end(), [](int a, int b) { return a > b; });
+
+    int i = 0;
+    while (i < rows.size()) {
+        int first = rows.at(i);
+        int count = 1;
+        while (i + count < rows.size() && rows.at(i + count) == first - 1) {
+            --first;
+            ++count;
+        }
+        m_model->removeRows(first, count);
+        i += count;
+    }
+    if (!rows.isEmpty()) {
+        updateThumbsCount();
+    }
+}
+
+void ThumbsViewer::invalidateThumb(QStandardItem *item, const QFileInfo &fileInfo) {
+    const QString imageFileName = item->data(FileNameRole).toString();
+    Metadata::forget(imageFileName);
+    const int histIndex = histFiles.indexOf(imageFileName);
+    if (histIndex > -1) {
+        histFiles.removeAt(histIndex);
+        histograms.removeAt(histIndex);
+        m_histSorted = false;
+    }
+    item->setData(fileInfo.size(), SizeRole);
+    item->setData(fileInfo.lastModified(), TimeRole);
+    item->setData(QVariant(), BrightnessRole);
+    uncacheThumb(item);
+    item->setData(false, LoadedRole);
+}
+
+// Without word which files changed, the listing is compared with the rows of the directory
+void ThumbsViewer::updateDirectory(const QString &path) {
+    QDir dir(thumbsDir);
+    dir.setPath(path);
+    QSet<QString> candidates;
+    if (dir.exists()) {
+        const QFileInfoList fileInfoList = dir.entryInfoList();
+        for (const QFileInfo &fileInfo : fileInfoList) {
+            candidates.insert(fileInfo.filePath());
+        }
+    }
+    const QString dirPath = QDir::cleanPath(path);
+    const QHash<QString, int> &index = rowIndex();
+    for (QHash<QString, int>::const_iterator it = index.cbegin(); it != index.cend(); ++it) {
+        if (QFileInfo(it.key()).path() == dirPath) {
+            candidates.insert(it.key());
+        }
+    }
+    updateFiles(candidates);
+}
+
+void ThumbsViewer::updateFiles(const QSet<QString> &paths) {
+    QList<int> removedRows;
+    QFileInfoList addedFiles;
+    for (const QString &path : paths) {
+        const QFileInfo fileInfo(path);
+        const int row = rowOf(path);
+        if (!fileInfo.isFile()) {
+            if (row > -1) {
+                Metadata::forget(path);
+                removedRows.append(row);
+            }
+            continue;
+        }
+        if (row > -1) {
+            QStandardItem *item = m_model->item(row);
+            if (fileInfo.lastModified() != item->data(TimeRole).toDateTime() ||
+                fileInfo.size() != item->data(SizeRole).toLongLong()) {
+                invalidateThumb(item, fileInfo);
+            }
+            continue;
+        }
+        // only what listing the directory with thumbsDir would have brought
+        if (QDir::match(thumbsDir.nameFilters(), fileInfo.fileName()) &&
+            ((thumbsDir.filter() & QDir::Hidden) || !fileInfo.isHidden())) {
+            addedFiles.append(fileInfo);
+        }
+    }
+
+    removeThumbRows(removedRows);
+
+    if (!addedFiles.isEmpty()) {
+        const int firstAdded = m_model->rowCount();
+        appendThumbs(addedFiles);
+        QSet<QString> directories;
+        for (int row = firstAdded; row < m_model->rowCount(); ++row) {
+            const QString addedPath = m_model->item(row)->data(FileNameRole).toString();
+            // new files are often still being written, follow them so the thumbnail gets redone once they're complete
+            m_watcher->followFile(addedPath);
+            directories.insert(QFileInfo(addedPath).path());
+        }
+        if (m_model->rowCount() > firstAdded) {
+            for (const QString &directory : std::as_const(directories)) {
+                renumberDirectory(directory);
+            }
+            m_model->sort(0, thumbsSortOrder);
+            updateThumbsCount();
+        }
+    }
+
+    thumbsRangeFirst = -1;
+    thumbsRangeLast = -1;
+    loadVisibleThumbs();
+}
+
+// appendThumbs() numbers the rows it adds from 0, which collides with the rows already there
+void ThumbsViewer::renumberDirectory(const QString &path) {
+    QFileInfoList fileInfoList;
+    if ((thumbsSortFlags & QDir::Time) || (thumbsSortFlags & QDir::Size) || (thumbsSortFlags & QDir::Type)) {
+        QDir dir(thumbsDir); // QDir sorts those
+        dir.setPath(path);
+        fileInfoList = dir.entryInfoList();
+    } else {
+        const QHash<QString, int> &index = rowIndex();
+        for (QHash<QString, int>::const_iterator it = index.cbegin(); it != index.cend(); ++it) {
+            if (QFileInfo(it.key()).path() == path) {
+                fileInfoList.append(QFileInfo(it.key()));
+            }
+        }
+        sortByName(fileInfoList, thumbsSortFlags);
+    }
+    for (int fileIndex = 0; fileIndex < fileInfoList.size(); ++fileIndex) {
+        if (QStandardItem *item = m_model->item(rowOf(fileInfoList.at(fileIndex).filePath()))) {
+            item->setData(fileIndex, SortRole);
+        }
+    }
+}
+
 void ThumbsViewer::updateThumbsCount() {
     emit status(m_model->rowCount() > 0 ? tr("%n image(s)", "", m_model->rowCount()) : tr("No images"));
     thumbsDir.setPath(Settings::currentDirectory);
@@ -841,42 +1280,15 @@ void ThumbsViewer::findDupes(bool resetCounters)
 
         thumbFileInfo = thumbFileInfoList.at(currThumb);
 
-        QImageReader imageReader;
-        QString imageFileName = thumbFileInfo.absoluteFilePath();
-        QImage image;
-        imageReader.setFileName(imageFileName);
-        imageReader.setQuality(50); // 50 is the threshold where Qt does fast decoding, but still good scaling
-        const QSize targetSize = imageReader.size();
-        QSize realSize;
-        QString thumbnailPath = locateThumbnail(imageFileName);
-        if (!thumbnailPath.isEmpty() && QImageReader(thumbnailPath).canRead()) {
-            imageReader.setFileName(thumbnailPath);
-            imageReader.read(&image);
-            realSize = QSize(image.text("Thumb::Image::Width").toInt(), image.text("Thumb::Image::Height").toInt());
-        }
-        if (targetSize != realSize) {
-            imageReader.setFileName(imageFileName);
-            imageReader.read(&image);
-        }
-
+        bool hashOk;
+        const QBitArray imageHash = ThumbnailCache::differenceHash(thumbFileInfo.absoluteFilePath(), thumbSize, &hashOk);
         ++scannedFiles;
 
-        if (image.isNull()) {
+        if (!hashOk) {
             qWarning() << "invalid image" << thumbFileInfo.fileName();
             continue;
         }
 
-        QBitArray imageHash(64);
-        image = image.convertToFormat(QImage::Format_Grayscale8).scaled(9, 9, Qt::KeepAspectRatioByExpanding /*, Qt::SmoothTransformation*/);
-        for (int y=0; y<8; ++y) {
-            const uchar *line = image.scanLine(y);
-            //const uchar *nextLine = image.scanLine(y+1);
-            for (int x=0; x<8; ++x) {
-                imageHash.setBit(y * 8 + x, line[x] > line[x+1]);
-                //imageHash.setBit(y * 8 + x + 64, line[x] > nextLine[x]);
-            }
-        }
-
         QString currentFilePath = thumbFileInfo.filePath();
 
         QHash<QBitArray, DuplicateImage>::iterator match = imageHashes.find(imageHash);
@@ -1140,131 +1552,109 @@ void ThumbsViewer::loadThumbsRange() {
     }
 }
 
-QString ThumbsViewer::thumbnailFileName(const QString &originalPath) const
-{
-    QFileInfo info(originalPath);
-    QString canonicalPath = info.canonicalFilePath();
-    if (canonicalPath.isEmpty()) {
-        qWarning() << originalPath << "does not exist!";
-        canonicalPath = info.absoluteFilePath();
-    }
-    QUrl url = QUrl::fromLocalFile(canonicalPath);
-    QCryptographicHash md5(QCryptographicHash::Md5);
-    md5.addData(QFile::encodeName(url.adjusted(QUrl::RemovePassword).url()));
-    return QString::fromLatin1(md5.result().toHex()) + QStringLiteral(".png");
-}
-
 QString ThumbsViewer::locateThumbnail(const QString &originalPath) const
 {
-#if defined(Q_OS_MAC) || defined(Q_OS_WIN)
-    return "";
-#endif
-    const QString basePath = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) +
-                                                                        QLatin1String("/thumbnails/");
-    if (originalPath.startsWith(basePath))
-        return QString(); // we're in the thumbnail cache, no point in checking stuff
-
-    QStringList folders = {
-        QStringLiteral("xx-large/"), // max 1024px
-        QStringLiteral("x-large/"), // max 512px
-        QStringLiteral("large/"), // max 256px, doesn't look too bad when upscaled to max
-    };
-
-    if (thumbSize <= 200) {
-        folders.append(QStringLiteral("normal/")); // 128px max
-    }
-    const QString filename = thumbnailFileName(originalPath);
-    const QFileInfo originalInfo(originalPath);
-    for (const QString &folder : folders) {
-        QFileInfo info(basePath + folder + filename);
-        if (!info.exists()) {
-            continue;
-        }
-        if (originalInfo.metadataChangeTime() > info.lastModified()) {
-            continue;
-        }
-        if (originalInfo.lastModified() > info.lastModified()) {
-            continue;
-        }
-        return info.absoluteFilePath();
-    }
-    return QString();
+    return ThumbnailCache::locate(originalPath, thumbSize);
 }
 
-void ThumbsViewer::storeThumbnail(const QString &originalPath, QImage thumbnail, const QSize &originalSize) const {
-#if defined(Q_OS_MAC) || defined(Q_OS_WIN)
-    return;
-#endif
-    const QString canonicalPath = QFileInfo(originalPath).canonicalFilePath();
-    if (canonicalPath.isEmpty()) {
-        qWarning() << "Asked to store thumbnail for non-existent path" << originalPath;
-        return;
+void ThumbsViewer::setThumbIcon(QStandardItem *item, QImage thumb, bool upscale) {
+    const QSize thumbSizeQ(thumbSize, thumbSize);
+    QSize targetSize = thumb.size();
+    if (upscale || targetSize.width() > thumbSize || targetSize.height() > thumbSize) {
+        targetSize.scale(thumbSizeQ, Settings::thumbsLayout != Classic ? Qt::KeepAspectRatioByExpanding : Qt::KeepAspectRatio);
     }
-
-    QString folder = QStringLiteral("normal/");
-    const int maxSize = qMax(thumbnail.width(), thumbnail.height());
-    if (maxSize < 64) {
-        qDebug() << "Refusing to store tiny thumbnail" << thumbnail.size();
-        return;
+    if (targetSize != thumb.size()) {
+        // shrinking the cached thumbnail is cheap, growing it is only a placeholder until the real decode
+        thumb = thumb.scaled(targetSize, Qt::IgnoreAspectRatio, targetSize.width() < thumb.width() ?
+                                                                Qt::SmoothTransformation : Qt::FastTransformation);
     }
-    if (maxSize >= 1024) {
-        folder = QStringLiteral("xx-large/");
-        thumbnail = thumbnail.scaled(1024, 1024, Qt::KeepAspectRatio);
-    } else if (maxSize >= 384) {
-        folder = QStringLiteral("x-large/");
-        thumbnail = thumbnail.scaled(512, 512, Qt::KeepAspectRatio);
-    } else if (maxSize > 200) {
-        folder = QStringLiteral("large/");
-        thumbnail = thumbnail.scaled(256, 256, Qt::KeepAspectRatio);
-    } else if (maxSize >= 100) {
-        folder = QStringLiteral("normal/");
-        thumbnail = thumbnail.scaled(128, 128, Qt::KeepAspectRatio);
-    } else {
-        qWarning() << "Thumbnail too small" << thumbnail.size();
-        return;
+
+    if (Settings::thumbsLayout != Classic) {
+        thumb = SmartCrop::crop(thumb, thumbSizeQ);
     }
 
-    const QString filename = thumbnailFileName(originalPath);
-    const QString basePath = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) +
-        QLatin1String("/thumbnails/");
+    item->setIcon(QPixmap::fromImage(thumb));
+    item->setSizeHint(itemSizeHint());
+}
 
-    if (!QFileInfo::exists(basePath + folder)) {
-        QDir().mkpath(basePath + folder);
+void ThumbsViewer::cacheThumb(QStandardItem *item, const QImage &thumb, bool complete) {
+    m_thumbCacheBytes += thumb.sizeInBytes() - item->data(ThumbImageRole).value<QImage>().sizeInBytes();
+    item->setData(thumb, ThumbImageRole);
+    item->setData(complete ? THUMB_SIZE_MAX : thumbSize, ThumbSizeRole);
+    // a Classic thumbnail only fits its longer side, cropped layouts need the shorter one covered
+    item->setData(Settings::thumbsLayout != Classic, ThumbExpandedRole);
+    if (m_thumbCacheBytes > gs_thumbCacheBudget) {
+        trimThumbCache();
     }
+}
 
-    const QString fullPath = basePath + folder + filename;
-    QFileInfo info(fullPath);
-
-    QDateTime lastModified = info.lastModified();
-    if (info.metadataChangeTime() > info.lastModified()) {
-        lastModified = info.metadataChangeTime();
+bool ThumbsViewer::cachedThumbFits(const QStandardItem *item) const {
+    const int size = item->data(ThumbSizeRole).toInt();
+    if (size == THUMB_SIZE_MAX) {
+        return true;
     }
-    thumbnail.setText(QStringLiteral("Thumb::MTime"), QString::number(lastModified.toSecsSinceEpoch()));
+    return size >= thumbSize && (Settings::thumbsLayout == Classic || item->data(ThumbExpandedRole).toBool());
+}
 
-    QUrl url = QUrl::fromLocalFile(canonicalPath).adjusted(QUrl::RemovePassword);
-    thumbnail.setText(QStringLiteral("Thumb::URI"), url.url());
+void ThumbsViewer::uncacheThumb(QStandardItem *item) {
+    m_thumbCacheBytes -= item->data(ThumbImageRole).value<QImage>().sizeInBytes();
+    item->setData(QVariant(), ThumbImageRole);
+    item->setData(QVariant(), ThumbSizeRole);
+    item->setData(QVariant(), ThumbExpandedRole);
+}
+
+void ThumbsViewer::trimThumbCache() {
+    const int first = qMax(0, thumbsRangeFirst);
+    const int last = qMax(first, thumbsRangeLast);
+    auto distance = [=](int row) { return row < first ? first - row : (row > last ? row - last : 0); };
 
-    thumbnail.setText(QStringLiteral("Thumb::Image::Width"), QString::number(originalSize.width()));
-    thumbnail.setText(QStringLiteral("Thumb::Image::Height"), QString::number(originalSize.height()));
-    thumbnail.setText("Software", "Phototonic");
-    thumbnail.convertToColorSpace(QColorSpace::SRgb);
+    QList<int> rows;
+    for (int row = 0; row < m_model->rowCount(); ++row) {
+        if (distance(row) > 0 && !m_model->item(row)->data(ThumbImageRole).isNull()) {
+            rows << row;
+        }
+    }
+    std::sort(rows.begin(), rows.end(), [=](int a, int b) { return distance(a) > distance(b); });
 
-    thumbnail.save(fullPath);
+    // some headroom, so that scrolling on doesn't trim again for every thumbnail
+    for (int row : std::as_const(rows)) {
+        if (m_thumbCacheBytes <= gs_thumbCacheBudget * 3 / 4) {
+            break;
+        }
+        uncacheThumb(m_model->item(row));
+    }
 }
 
 bool ThumbsViewer::loadThumb(int currThumb, bool fastOnly) {
-    if (!m_model->item(currThumb)) {
+    QStandardItem *item = m_model->item(currThumb);
+    if (!item) {
         qDebug() << "meeek: loadThumb for invalid row" << currThumb;
         return false;
     }
-    if (m_model->item(currThumb)->data(LoadedRole).toBool())
+    if (item->data(LoadedRole).toBool())
         return true;
 
+    // The largest thumbnail decoded so far is kept with the item, smaller sizes are derived from it
+    const QImage cachedThumb = item->data(ThumbImageRole).value<QImage>();
+    if (!cachedThumb.isNull()) {
+        if (cachedThumbFits(item)) {
+            setThumbIcon(item, cachedThumb, Settings::upscalePreview);
+            item->setData(true, LoadedRole);
+            return true;
+        }
+        if (fastOnly) {
+            // zoomed in, show what we have and upgrade it in the second pass
+            setThumbIcon(item, cachedThumb, true);
+            return true;
+        }
+    }
+
     QImageReader thumbReader;
-    QString imageFileName = m_model->item(currThumb)->data(FileNameRole).toString();
+    QString imageFileName = item->data(FileNameRole).toString();
     QImage thumb;
     bool imageReadOk = false;
     bool shouldStoreThumbnail = false;
+    bool scaleMe = false;
 
     thumbReader.setFileName(imageFileName);
     thumbReader.setQuality(50); // 50 is the threshold where Qt does fast decoding, but still good scaling
@@ -1298,7 +1688,7 @@ bool ThumbsViewer::loadThumb(int currThumb, bool fastOnly) {
 
     QSize thumbSizeQ(thumbSize,thumbSize);
     if (currentThumbSize.isValid()) {
-        bool scaleMe =  Settings::upscalePreview ||
+        scaleMe =  Settings::upscalePreview ||
                         currentThumbSize.width() > thumbSize ||
                         currentThumbSize.height() > thumbSize;
         if (scaleMe && currentThumbSize != thumbSizeQ) {
@@ -1325,32 +1715,33 @@ bool ThumbsViewer::loadThumb(int currThumb, bool fastOnly) {
         }
     }
 
+    // the row might have been removed while we were processing events
+    if (m_model->item(currThumb) != item)
+        return false;
+
     if (imageReadOk) {
         if (shouldStoreThumbnail) {
             if (!origThumbSize.isValid() || qMax(origThumbSize.width(), origThumbSize.height()) > 1024)
-                storeThumbnail(imageFileName, thumb, origThumbSize);
+                ThumbnailCache::store(imageFileName, thumb, origThumbSize);
 //            else
 //                qDebug() << "not storing thumb for pathetically small image" << origThumbSize;
         }
         if (Settings::exifThumbRotationEnabled) {
             thumb = thumb.transformed(Metadata::transformation(imageFileName), Qt::SmoothTransformation);
-            currentThumbSize = thumb.size();
-            currentThumbSize.scale(thumbSizeQ, Settings::thumbsLayout != Classic ? Qt::KeepAspectRatioByExpanding : Qt::KeepAspectRatio);
         }
 
-        m_model->item(currThumb)->setData(qGray(thumb.scaled(1, 1, Qt::IgnoreAspectRatio, Qt::SmoothTransformation).pixel(0, 0)) / 255.0, BrightnessRole);
-
-        if (Settings::thumbsLayout != Classic) {
-            thumb = SmartCrop::crop(thumb, thumbSizeQ);
+        if (cachedThumb.isNull()) { // an upgrade doesn't change the brightness or histogram
+            item->setData(qGray(thumb.scaled(1, 1, Qt::IgnoreAspectRatio, Qt::SmoothTransformation).pixel(0, 0)) / 255.0, BrightnessRole);
+            histograms.append(calcHist(thumb));
+            histFiles.append(imageFileName);
         }
 
-        m_model->item(currThumb)->setIcon(QPixmap::fromImage(thumb));
-        m_model->item(currThumb)->setData(true, LoadedRole);
-        histograms.append(calcHist(thumb));
-        histFiles.append(imageFileName);
-        m_model->item(currThumb)->setSizeHint(itemSizeHint());
+        // an image that wasn't scaled down is complete, no later zoom level will need to decode it again
+        cacheThumb(item, thumb, !scaleMe);
+        setThumbIcon(item, thumb, false);
+        item->setData(true, LoadedRole);
     } else {
-        m_model->item(currThumb)->setIcon(QIcon::fromTheme("image-missing",
+        item->setIcon(QIcon::fromTheme("image-missing",
                                                                      QIcon(":/images/error_image.png")).pixmap(
                 BAD_IMAGE_SIZE, BAD_IMAGE_SIZE));
         currentThumbSize.setHeight(BAD_IMAGE_SIZE);
@@ -1388,7 +1779,8 @@ QStandardItem * ThumbsViewer::addThumb(const QString &imageFullPath) {
     thumbReader.setFileName(imageFullPath);
     currThumbSize = thumbReader.size();
     if (currThumbSize.isValid()) {
-        if (Settings::upscalePreview || currThumbSize.width() > thumbSize || currThumbSize.height() > thumbSize) {
+        const bool scaleMe = Settings::upscalePreview || currThumbSize.width() > thumbSize || currThumbSize.height() > thumbSize;
+        if (scaleMe) {
             currThumbSize.scale(QSize(thumbSize, thumbSize), Settings::thumbsLayout != Classic ? Qt::KeepAspectRatioByExpanding : Qt::KeepAspectRatio);
         }
 
@@ -1407,6 +1799,7 @@ QStandardItem * ThumbsViewer::addThumb(const QString &imageFullPath) {
             currThumbSize.scale(QSize(thumbSize, thumbSize), Settings::thumbsLayout != Classic ? Qt::KeepAspectRatioByExpanding : Qt::KeepAspectRatio);
         }
         thumbItem->setData(qGray(thumb.scaled(1, 1, Qt::IgnoreAspectRatio, Qt::SmoothTransformation).pixel(0, 0)) / 255.0, BrightnessRole);
+        cacheThumb(thumbItem, thumb, !scaleMe);
 
         thumbItem->setIcon(QPixmap::fromImage(thumb));
     } else {
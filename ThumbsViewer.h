@@ -19,6 +19,7 @@
 #ifndef THUMBS_VIEWER_H
 #define THUMBS_VIEWER_H
 
+class DirectoryWatcher;
 class ImageTags;
 
 class QStandardItem;
@@ -27,7 +28,9 @@ class QStandardItemModel;
 #include <QBitArray>
 #include <QDir>
 #include <QFileInfoList>
+#include <QHash>
 #include <QListView>
+#include <QSet>
 #include <QTimer>
 
 struct Histogram
@@ -84,7 +87,10 @@ public:
         TypeRole,
         SizeRole,
         TimeRole,
-        HistogramRole
+        HistogramRole,
+        ThumbImageRole,
+        ThumbSizeRole,
+        ThumbExpandedRole
     };
     enum ThumbnailLayouts {
         Classic,
@@ -94,7 +100,7 @@ public:
 
     ThumbsViewer(QWidget *parent);
 
-    void loadPrepare();
+    void loadPrepare(bool keepRows = false);
 
     void applyFilter();
 
@@ -110,12 +116,16 @@ public:
     using QListView::setCurrentIndex;
     bool setCurrentIndex(const QString &fileName);
     bool setCurrentIndex(int row);
+    // the row of an image, -1 if it isn't listed
+    int rowOf(const QString &imageFullPath) const;
 
     void setNeedToScroll(bool needToScroll);
 
     void selectCurrentIndex();
 
     QStandardItem *addThumb(const QString &imageFullPath);
+    // from the back in contiguous ranges, rows don't need to be sorted
+    void removeThumbRows(QList<int> rows);
 
     void abort(bool permanent = false);
 
@@ -144,6 +154,7 @@ public:
     ImageTags *imageTags;
     QDir thumbsDir;
     QDir::SortFlags thumbsSortFlags;
+    Qt::SortOrder thumbsSortOrder = Qt::AscendingOrder;
     int thumbSize;
 
 signals:
@@ -158,8 +169,20 @@ protected:
 
 private:
     void initThumbs();
+    void appendThumbs(const QFileInfoList &fileInfoList);
+    void invalidateThumb(QStandardItem *item, const QFileInfo &fileInfo);
+    void removeStaleThumbs();
+    void updateDirectory(const QString &path);
+    void updateFiles(const QSet<QString> &paths);
+    void renumberDirectory(const QString &path);
+    const QHash<QString, int> &rowIndex() const;
 
     bool loadThumb(int row, bool fastOnly = false);
+    void cacheThumb(QStandardItem *item, const QImage &thumb, bool complete);
+    bool cachedThumbFits(const QStandardItem *item) const;
+    void uncacheThumb(QStandardItem *item);
+    void trimThumbCache();
+    void setThumbIcon(QStandardItem *item, QImage thumb, bool upscale);
 
     void findDupes(bool resetCounters);
 
@@ -169,8 +192,6 @@ private:
 
     QSize itemSizeHint() const;
 
-    QString thumbnailFileName(const QString &path) const;
-    void storeThumbnail(const QString &originalPath, QImage thumbnail, const QSize &originalSize) const;
 
     QFileInfo thumbFileInfo;
     QFileInfoList thumbFileInfoList;
@@ -193,6 +214,19 @@ private:
     bool m_busy;
     QStandardItemModel *m_model;
     QString m_desiredThumbPath;
+    DirectoryWatcher *m_watcher;
+    QTimer m_directoryChangedTimer;
+    QSet<QString> m_changedDirectories;
+    QSet<QString> m_changedFiles;
+    QString m_listedDirectory;
+    unsigned int m_listedThumbsLayout = Classic;
+    bool m_relayoutKeptRows = false;
+    QSet<QString> m_staleItems;
+    // the row of each path, rebuilt by rowIndex() once rows moved
+    mutable QHash<QString, int> m_rowIndex;
+    mutable bool m_rowIndexDirty = false;
+    // what the decoded thumbnails kept with the items take up
+    qint64 m_thumbCacheBytes = 0;
 
 public slots:
     void loadVisibleThumbs(int scrollBarValue = 0);
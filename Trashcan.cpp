@@ -38,53 +38,56 @@
 #include <fcntl.h>
 #include <cerrno>
 
-static Trash::Result moveToTrashDir(const QString& filePath, const QDir& trashDir, QString& error, const QStorageInfo& nonHomeStorage)
+static bool setUpTrashDir(const QDir& trashDir)
 {
+    return QDir(trashDir.filePath("info")).mkpath(".") && QDir(trashDir.filePath("files")).mkpath(".");
+}
+
+Trash::Result Trash::moveToTrash(const QString &filePath, const Trash::Location &location, QString &error)
+{
+    const QDir trashDir(location.trashDirectory);
     const QDir trashInfoDir = QDir(trashDir.filePath("info"));
     const QDir trashFilesDir = QDir(trashDir.filePath("files"));
-    if (trashInfoDir.mkpath(".") && trashFilesDir.mkpath(".")) {
-        QFileInfo fileInfo(filePath);
-        QString fileName = fileInfo.fileName();
-        QString infoFileName = fileName + ".trashinfo";
-        int fd;
-        const int flag = O_CREAT | O_WRONLY | O_EXCL;
-        const int mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
-        for (unsigned int n = 2; trashFilesDir.exists(fileName) ||
-             ((fd = open(trashInfoDir.filePath(infoFileName).toUtf8().data(), flag, mode)) == -1 && errno == EEXIST); ++n) {
-            fileName = QString("%1.%2.%3").arg(fileInfo.baseName(), QString::number(n), fileInfo.completeSuffix());
-            infoFileName = fileName + ".trashinfo";
-        }
-        if (fd == -1) {
-            error = strerror(errno);
-            return Trash::Error;
-        }
-        const QString moveHere = trashFilesDir.filePath(fileName);
-        const QString deletionDate = QDateTime::currentDateTime().toString(Qt::ISODate);
-        const QString path = nonHomeStorage.isValid() ? QDir(nonHomeStorage.rootPath()).relativeFilePath(filePath) : filePath;
-        const QString escapedPath = QString::fromUtf8(QUrl::toPercentEncoding(path, "/"));
-        QFile infoFile;
-        if (infoFile.open(fd, QIODevice::WriteOnly, QFileDevice::AutoCloseHandle)) {
-            QTextStream out(&infoFile);
-            out << "[Trash Info]\nPath=" << escapedPath << "\nDeletionDate=" << deletionDate << '\n';
-        } else {
-            error = infoFile.errorString();
-            return Trash::Error;
-        }
+    QFileInfo fileInfo(filePath);
+    QString fileName = fileInfo.fileName();
+    QString infoFileName = fileName + ".trashinfo";
+    int fd;
+    const int flag = O_CREAT | O_WRONLY | O_EXCL;
+    const int mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+    // creating the info file exclusively reserves the name, also against other threads trashing into the same directory
+    for (unsigned int n = 2; trashFilesDir.exists(fileName) ||
+         ((fd = open(trashInfoDir.filePath(infoFileName).toUtf8().data(), flag, mode)) == -1 && errno == EEXIST); ++n) {
+        fileName = QString("%1.%2.%3").arg(fileInfo.baseName(), QString::number(n), fileInfo.completeSuffix());
+        infoFileName = fileName + ".trashinfo";
+    }
+    if (fd == -1) {
+        error = strerror(errno);
+        return Trash::Error;
+    }
+    const QString moveHere = trashFilesDir.filePath(fileName);
+    const QString deletionDate = QDateTime::currentDateTime().toString(Qt::ISODate);
+    const QString path = location.topdir.isEmpty() ? filePath : QDir(location.topdir).relativeFilePath(filePath);
+    const QString escapedPath = QString::fromUtf8(QUrl::toPercentEncoding(path, "/"));
+    QFile infoFile;
+    if (infoFile.open(fd, QIODevice::WriteOnly, QFileDevice::AutoCloseHandle)) {
+        QTextStream out(&infoFile);
+        out << "[Trash Info]\nPath=" << escapedPath << "\nDeletionDate=" << deletionDate << '\n';
+    } else {
+        error = infoFile.errorString();
+        return Trash::Error;
+    }
 
 
-        if (QDir().rename(filePath, moveHere)) {
-            return Trash::Success;
-        } else {
-            error = QString("Could not rename %1 to %2").arg(filePath, moveHere);
-            return Trash::Error;
-        }
+    if (QDir().rename(filePath, moveHere)) {
+        return Trash::Success;
     } else {
-        error = "Could not set up trash subdirectories";
+        QFile::remove(trashInfoDir.filePath(infoFileName));
+        error = QString("Could not rename %1 to %2").arg(filePath, moveHere);
         return Trash::Error;
     }
 }
 
-Trash::Result Trash::moveToTrash(const QString &path, QString &error, Trash::Options trashOptions)
+Trash::Result Trash::locate(const QString &path, Trash::Location &location, QString &error, Trash::Options trashOptions)
 {
     if (path.isEmpty()) {
         error = "Path is empty";
@@ -105,35 +108,50 @@ Trash::Result Trash::moveToTrash(const QString &path, QString &error, Trash::Opt
 
     if (QStorageInfo(homeDataLocation) == filePathStorage || trashOptions == Trash::ForceDeletionToHomeTrash) {
         const QDir homeTrashDirectory = QDir(homeDataDirectory.filePath("Trash"));
-        if (homeTrashDirectory.mkpath(".")) {
-            return moveToTrashDir(filePath, homeTrashDirectory, error, QStorageInfo());
+        if (setUpTrashDir(homeTrashDirectory)) {
+            location.trashDirectory = homeTrashDirectory.path();
+            location.topdir.clear();
+            return Trash::Success;
         } else {
-            error = "Could not ensure that home trash directory exists";
+            error = "Could not set up trash subdirectories";
             return Trash::Error;
         }
     } else {
         const QDir topdir = QDir(filePathStorage.rootPath());
         const QDir topdirTrash = QDir(topdir.filePath(".Trash"));
+        location.topdir = filePathStorage.rootPath();
         struct stat trashStat;
         if (lstat(topdirTrash.path().toUtf8().data(), &trashStat) == 0) {
             // should be a directory, not link, and have sticky bit
             if (S_ISDIR(trashStat.st_mode) && !S_ISLNK(trashStat.st_mode) && (trashStat.st_mode & S_ISVTX)) {
-                const QString subdir = QString::number(getuid());
-                if (topdirTrash.mkpath(subdir)) {
-                    return moveToTrashDir(filePath, QDir(topdirTrash.filePath(subdir)), error, filePathStorage);
+                const QDir topdirTrashSubdir = QDir(topdirTrash.filePath(QString::number(getuid())));
+                if (setUpTrashDir(topdirTrashSubdir)) {
+                    location.trashDirectory = topdirTrashSubdir.path();
+                    return Trash::Success;
                 }
             }
         }
         // if we're still here, $topdir/.Trash does not exist or failed some check
         QDir topdirUserTrash = QDir(topdir.filePath(QString(".Trash-%1").arg(getuid())));
-        if (topdirUserTrash.mkpath(".")) {
-            return moveToTrashDir(filePath, topdirUserTrash, error, filePathStorage);
+        if (setUpTrashDir(topdirUserTrash)) {
+            location.trashDirectory = topdirUserTrash.path();
+            return Trash::Success;
         }
         error = "Could not find trash directory for the disk where the file resides";
         return Trash::NeedsUserInput;
     }
 }
 
+Trash::Result Trash::moveToTrash(const QString &path, QString &error, Trash::Options trashOptions)
+{
+    Trash::Location location;
+    const Trash::Result result = locate(path, location, error, trashOptions);
+    if (result != Trash::Success) {
+        return result;
+    }
+    return moveToTrash(QFileInfo(path).absoluteFilePath(), location, error);
+}
+
 #elif defined(Q_OS_WIN)
 #include <windows.h>
 #include <shellapi.h>
@@ -158,6 +176,22 @@ Trash::Result Trash::moveToTrash(const QString &path, QString &error, Trash::Opt
     }
     return Trash::Success;
 }
+
+// the shell finds the recycle bin of each drive by itself
+Trash::Result Trash::locate(const QString &path, Trash::Location &location, QString &error, Trash::Options trashOptions)
+{
+    Q_UNUSED(path);
+    Q_UNUSED(error);
+    Q_UNUSED(trashOptions);
+    location = Trash::Location();
+    return Trash::Success;
+}
+
+Trash::Result Trash::moveToTrash(const QString &path, const Trash::Location &location, QString &error)
+{
+    Q_UNUSED(location);
+    return moveToTrash(path, error);
+}
 #else
 
 Trash::Result Trash::moveToTrash(const QString &path, QString &error, Trash::Options trashOptions)
@@ -166,4 +200,18 @@ Trash::Result Trash::moveToTrash(const QString &path, QString &error, Trash::Opt
     return Trash::Error;
 }
 
+Trash::Result Trash::locate(const QString &path, Trash::Location &location, QString &error, Trash::Options trashOptions)
+{
+    Q_UNUSED(path);
+    Q_UNUSED(location);
+    Q_UNUSED(trashOptions);
+    error = "Putting files into trashcan is not supported for this platform yet";
+    return Trash::Error;
+}
+
+Trash::Result Trash::moveToTrash(const QString &path, const Trash::Location &location, QString &error)
+{
+    return moveToTrash(path, error);
+}
+
 #endif
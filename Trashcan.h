@@ -35,7 +35,20 @@ namespace Trash {
         ForceDeletionToHomeTrash = 1
     } Options;
 
+    // Where the files of one device go
+    struct Location
+    {
+        QString trashDirectory;
+        // trashed paths are recorded relative to this, empty for the home trash
+        QString topdir;
+    };
+
     Trash::Result moveToTrash(const QString &filePath, QString &error, Options trashOptions = NoOptions);
+
+    // For trashing many files: finds and sets up the trash of the device filePath is on,
+    // which then takes all the other files of that device
+    Trash::Result locate(const QString &filePath, Location &location, QString &error, Options trashOptions = NoOptions);
+    Trash::Result moveToTrash(const QString &filePath, const Location &location, QString &error);
 }
 
 #endif // TRASHCAN_H
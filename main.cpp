@@ -16,14 +16,18 @@
  *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "CommandLine.h"
 #include "Phototonic.h"
 #include <QApplication>
 #include <QCommandLineParser>
 #include <QLibraryInfo>
+#include <QScopedPointer>
 #include <QTranslator>
 
 int main(int argc, char *argv[]) {
-    QApplication QApp(argc, argv);
+    // batch work runs without a display
+    const bool headless = CommandLine::isHeadless(argc, argv);
+    QScopedPointer<QCoreApplication> QApp(headless ? new QCoreApplication(argc, argv) : new QApplication(argc, argv));
     QLocale locale = QLocale::system();
     QCoreApplication::setApplicationVersion(VERSION);
 
@@ -44,23 +48,27 @@ int main(int argc, char *argv[]) {
             QCoreApplication::translate("main", "Copy all modified images into <directory>."),
             QCoreApplication::translate("main", "directory"));
     parser.addOption(targetDirectoryOption);
+    CommandLine::addOptions(parser);
 
-    parser.process(QApp);
+    parser.process(*QApp);
 
     if (parser.isSet(langOption))
         locale = QLocale(parser.value(langOption));
 
     QTranslator qTranslator;
     if (qTranslator.load(locale, "qt", "_", QLibraryInfo::path(QLibraryInfo::TranslationsPath)))
-        QApp.installTranslator(&qTranslator);
+        QApp->installTranslator(&qTranslator);
 
     QTranslator qTranslatorPhototonic;
     if (qTranslatorPhototonic.load(locale, "phototonic", "_", ":/translations"))
-        QApp.installTranslator(&qTranslatorPhototonic);
+        QApp->installTranslator(&qTranslatorPhototonic);
+
+    if (headless)
+        return CommandLine::run(parser, parser.value(targetDirectoryOption));
 
     Phototonic phototonic(parser.positionalArguments(), 0);
     if (parser.isSet(targetDirectoryOption))
         phototonic.setSaveDirectory(parser.value(targetDirectoryOption));
     phototonic.show();
-    return QApp.exec();
+    return QApp->exec();
 }
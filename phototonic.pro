@@ -44,14 +44,15 @@ HEADERS += Phototonic.h ThumbsViewer.h ImageViewer.h CropRubberband.h SettingsDi
 			FileSystemTree.h Bookmarks.h DirCompleter.h Tags.h MetadataCache.h ShortcutsTable.h CopyMoveDialog.h \
 			CopyMoveToDialog.h CropDialog.h ProgressDialog.h ColorsDialog.h ResizeDialog.h ExternalAppsDialog.h \
 			ImageWidget.h FileListWidget.h RenameDialog.h Trashcan.h MessageBox.h \
-			GuideWidget.h RangeInputDialog.h SmartCrop.h
+			GuideWidget.h RangeInputDialog.h SmartCrop.h FileSystemModel.h ImagePreloader.h ImageTiles.h BatchTransform.h ThumbnailCache.h CommandLine.h MetadataWriter.h FileCopier.h FileDeleter.h DirectoryWatcher.h
 
 SOURCES += main.cpp Phototonic.cpp ThumbsViewer.cpp ImageViewer.cpp CropRubberband.cpp SettingsDialog.cpp \
 			Settings.cpp InfoViewer.cpp FileSystemTree.cpp Bookmarks.cpp DirCompleter.cpp Tags.cpp \
 			MetadataCache.cpp ShortcutsTable.cpp CopyMoveDialog.cpp CopyMoveToDialog.cpp CropDialog.cpp \
 			ProgressDialog.cpp ExternalAppsDialog.cpp ColorsDialog.cpp ResizeDialog.cpp \
 			ImageWidget.cpp FileListWidget.cpp RenameDialog.cpp Trashcan.cpp MessageBox.cpp \
-			GuideWidget.cpp RangeInputDialog.cpp IconProvider.cpp SmartCrop.cpp
+			GuideWidget.cpp RangeInputDialog.cpp IconProvider.cpp SmartCrop.cpp \
+			FileSystemModel.cpp ImagePreloader.cpp ImageTiles.cpp BatchTransform.cpp ThumbnailCache.cpp CommandLine.cpp MetadataWriter.cpp FileCopier.cpp FileDeleter.cpp DirectoryWatcher.cpp
 
 FORMS += RangeInputDialog.ui
 